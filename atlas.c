@@ -0,0 +1,91 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "atlas.h"
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+void
+atlas_init(atlas_t *a, int size)
+{
+  memset(a, 0, sizeof(atlas_t));
+  a->size = size;
+
+  glGenTextures(1, &a->texture);
+  glBindTexture(GL_TEXTURE_2D, a->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+int
+atlas_alloc(atlas_t *a, int width, int height, int rect[2])
+{
+  atlas_shelf_t *s, *best = NULL;
+  int i;
+
+  width += ATLAS_PADDING * 2;
+  height += ATLAS_PADDING * 2;
+  if (width > a->size || height > a->size) {
+    return 0;
+  }
+
+  // Lowest shelf that is tall enough and has room left
+  for (i = 0; i < a->shelf_count; ++i) {
+    s = &a->shelves[i];
+    if (s->height >= height && s->x + width <= a->size &&
+        (!best || s->height < best->height))
+    {
+      best = s;
+    }
+  }
+
+  if (!best) {
+    if (a->top + height > a->size) {
+      return 0;
+    }
+
+    if (a->shelf_count >= a->shelf_cap) {
+      a->shelf_cap = a->shelf_cap ? (a->shelf_cap << 1) : 16;
+      assert((a->shelves = (atlas_shelf_t*)realloc(a->shelves,
+                           sizeof(atlas_shelf_t) * a->shelf_cap)));
+    }
+
+    best = &a->shelves[a->shelf_count++];
+    best->y = a->top;
+    best->height = height;
+    best->x = 0;
+    a->top += height;
+  }
+
+  rect[0] = best->x + ATLAS_PADDING;
+  rect[1] = best->y + ATLAS_PADDING;
+  best->x += width;
+  return 1;
+}
+
+void
+atlas_reset(atlas_t *a)
+{
+  a->shelf_count = 0;
+  a->top = 0;
+}
+
+void
+atlas_destroy(atlas_t *a)
+{
+  if (a->texture) {
+    glDeleteTextures(1, &a->texture);
+  }
+  free(a->shelves);
+  memset(a, 0, sizeof(atlas_t));
+}
@@ -0,0 +1,51 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __ATLAS_H__
+#define __ATLAS_H__
+
+#include <GL/glew.h>
+
+// Side of the atlas texture, in pixels
+#define ATLAS_SIZE 2048
+// Windows no larger than this in either direction go into the atlas
+#define ATLAS_MAX_WINDOW 512
+// Gap left around each rectangle
+#define ATLAS_PADDING 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Row of rectangles of similar height
+typedef struct atlas_shelf_t
+{
+  int               y;
+  int               height;
+  int               x;
+} atlas_shelf_t;
+
+// Shared texture holding the contents of small windows. Rectangles are
+// packed on shelves and never freed one by one: when the atlas is full it
+// is reset and the remaining windows are packed and copied again.
+typedef struct atlas_t
+{
+  GLuint            texture;
+  int               size;
+  atlas_shelf_t    *shelves;
+  int               shelf_count;
+  int               shelf_cap;
+  int               top;
+} atlas_t;
+
+void atlas_init(atlas_t *, int size);
+int atlas_alloc(atlas_t *, int width, int height, int rect[2]);
+void atlas_reset(atlas_t *);
+void atlas_destroy(atlas_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__ATLAS_H__*/
@@ -0,0 +1,210 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "shader/windows.vs.glsl.h"
+#include "shader/windows.fs.glsl.h"
+
+// -----------------------------------------------------------------------------
+// Internal stuff
+// -----------------------------------------------------------------------------
+static void
+grow_commands(batch_t *b, int count)
+{
+  batch_command_t *cmds;
+  int i;
+
+  if (count <= b->command_cap) {
+    return;
+  }
+  while (b->command_cap < count) {
+    b->command_cap = b->command_cap ? (b->command_cap << 1) : BATCH_UNITS;
+  }
+
+  // Every window draws the same quad, from its own instance
+  assert((cmds = (batch_command_t*)malloc(sizeof(batch_command_t) *
+                                          b->command_cap)));
+  for (i = 0; i < b->command_cap; ++i) {
+    cmds[i].count = 6;
+    cmds[i].instance_count = 1;
+    cmds[i].first_index = 0;
+    cmds[i].base_vertex = 0;
+    cmds[i].base_instance = i;
+  }
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, b->commands);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(batch_command_t) *
+               b->command_cap, cmds, GL_STATIC_DRAW);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  free(cmds);
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+int
+batch_init(batch_t *b, shaders_t *shaders)
+{
+  static const float QUAD[] =
+  {
+    -1.0f,  1.0f, 0.0f, 0.0f,
+     1.0f,  1.0f, 1.0f, 0.0f,
+     1.0f, -1.0f, 1.0f, 1.0f,
+    -1.0f, -1.0f, 0.0f, 1.0f
+  };
+  static const GLushort INDICES[] = { 0, 1, 2, 0, 2, 3 };
+
+  // The commands pick each window's matrix through baseInstance, which
+  // is reserved without ARB_base_instance. Sub-draws of one multi-draw
+  // share fragment invocations, so the texture index is not dynamically
+  // uniform: only NV_gpu_shader5 allows indexing samplers with it.
+  memset(b, 0, sizeof(batch_t));
+  if (!GLEW_ARB_multi_draw_indirect || !GLEW_ARB_shader_draw_parameters ||
+      !GLEW_ARB_base_instance || !GLEW_NV_gpu_shader5)
+  {
+    return 0;
+  }
+
+  // Drawing windows one by one still works if the driver rejects it
+  if (!shader_init_optional(shaders, &b->shader,
+                            SHADER_DIR "/windows.vs.glsl",
+                            shader_windows_vs_glsl,
+                            shader_windows_vs_glsl_len,
+                            SHADER_DIR "/windows.fs.glsl",
+                            shader_windows_fs_glsl,
+                            shader_windows_fs_glsl_len))
+  {
+    return 0;
+  }
+  batch_locate(b);
+
+  glGenBuffers(1, &b->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, b->vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD), QUAD, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glGenBuffers(1, &b->ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b->ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(INDICES), INDICES,
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  glGenBuffers(1, &b->instances);
+  glGenBuffers(1, &b->commands);
+  grow_commands(b, BATCH_UNITS);
+
+  b->supported = 1;
+  return 1;
+}
+
+void
+batch_locate(batch_t *b)
+{
+  GLint units[BATCH_UNITS];
+  int i;
+
+  b->a_pos = glGetAttribLocation(b->shader.prog, "a_pos");
+  b->a_tc = glGetAttribLocation(b->shader.prog, "a_tc");
+  b->a_model = glGetAttribLocation(b->shader.prog, "a_model");
+  b->u_textures = glGetUniformLocation(b->shader.prog, "u_textures");
+
+  // Sub-draw i samples unit i
+  for (i = 0; i < BATCH_UNITS; ++i) {
+    units[i] = i;
+  }
+  glUseProgram(b->shader.prog);
+  glUniform1iv(b->u_textures, BATCH_UNITS, units);
+  glUseProgram(0);
+}
+
+void
+batch_add(batch_t *b, GLuint texture, mat4x4 model)
+{
+  if (b->count >= b->cap) {
+    b->cap = b->cap ? (b->cap << 1) : BATCH_UNITS;
+    assert((b->models = (mat4x4*)realloc(b->models,
+                        sizeof(mat4x4) * b->cap)));
+    assert((b->textures = (GLuint*)realloc(b->textures,
+                          sizeof(GLuint) * b->cap)));
+  }
+
+  mat4x4_dup(b->models[b->count], model);
+  b->textures[b->count] = texture;
+  b->count++;
+}
+
+void
+batch_draw(batch_t *b)
+{
+  const GLsizei stride = sizeof(float) * 4;
+  int first, n, i;
+
+  if (!b->count) {
+    return;
+  }
+  grow_commands(b, b->count);
+
+  glBindBuffer(GL_ARRAY_BUFFER, b->instances);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(mat4x4) * b->count, b->models,
+               GL_STREAM_DRAW);
+  for (i = 0; i < 4; ++i) {
+    glEnableVertexAttribArray(b->a_model + i);
+    glVertexAttribPointer(b->a_model + i, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(mat4x4), (void*)(sizeof(float) * 4 * i));
+    glVertexAttribDivisor(b->a_model + i, 1);
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, b->vbo);
+  glEnableVertexAttribArray(b->a_pos);
+  glEnableVertexAttribArray(b->a_tc);
+  glVertexAttribPointer(b->a_pos, 2, GL_FLOAT, GL_FALSE, stride, 0);
+  glVertexAttribPointer(b->a_tc, 2, GL_FLOAT, GL_FALSE, stride,
+                        (void*)(sizeof(float) * 2));
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b->ibo);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, b->commands);
+  glUseProgram(b->shader.prog);
+
+  // One submission per BATCH_UNITS windows, in the order they were added
+  for (first = 0; first < b->count; first += BATCH_UNITS) {
+    n = b->count - first < BATCH_UNITS ? b->count - first : BATCH_UNITS;
+    for (i = 0; i < n; ++i) {
+      glActiveTexture(GL_TEXTURE0 + i);
+      glBindTexture(GL_TEXTURE_2D, b->textures[first + i]);
+    }
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT,
+                                (void*)(sizeof(batch_command_t) * first),
+                                n, 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  glUseProgram(0);
+  for (i = 0; i < 4; ++i) {
+    glVertexAttribDivisor(b->a_model + i, 0);
+    glDisableVertexAttribArray(b->a_model + i);
+  }
+  glDisableVertexAttribArray(b->a_pos);
+  glDisableVertexAttribArray(b->a_tc);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  b->count = 0;
+}
+
+void
+batch_destroy(batch_t *b)
+{
+  if (b->supported) {
+    glDeleteBuffers(1, &b->vbo);
+    glDeleteBuffers(1, &b->ibo);
+    glDeleteBuffers(1, &b->instances);
+    glDeleteBuffers(1, &b->commands);
+  }
+  free(b->models);
+  free(b->textures);
+  memset(b, 0, sizeof(batch_t));
+}
@@ -0,0 +1,67 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <GL/glew.h>
+#include "linmath.h"
+#include "shader.h"
+
+// Windows per multi-draw, one texture unit each
+#define BATCH_UNITS 16
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Layout of GL_DRAW_INDIRECT_BUFFER entries
+typedef struct batch_command_t
+{
+  GLuint            count;
+  GLuint            instance_count;
+  GLuint            first_index;
+  GLint             base_vertex;
+  GLuint            base_instance;
+} batch_command_t;
+
+// Draws window quads with one glMultiDrawElementsIndirect per group of
+// BATCH_UNITS windows instead of a bind and a draw each. Windows are
+// queued with batch_add and drawn in that order by batch_draw. Only
+// NV_gpu_shader5 defines the per-draw sampler index, so other stacks keep
+// drawing windows one by one: pixmap textures cannot take bindless
+// handles, and a texture array would copy every window on each damage.
+typedef struct batch_t
+{
+  int               supported;
+  GLuint            vbo;
+  GLuint            ibo;
+  GLuint            instances;
+  GLuint            commands;
+  int               command_cap;
+
+  // Windows queued since the last draw
+  mat4x4           *models;
+  GLuint           *textures;
+  int               count;
+  int               cap;
+
+  shader_t          shader;
+  GLint             a_pos;
+  GLint             a_tc;
+  GLint             a_model;
+  GLint             u_textures;
+} batch_t;
+
+int batch_init(batch_t *, shaders_t *);
+void batch_locate(batch_t *);
+void batch_add(batch_t *, GLuint texture, mat4x4 model);
+void batch_draw(batch_t *);
+void batch_destroy(batch_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__BATCH_H__*/
@@ -0,0 +1,178 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "linmath_batch.h"
+
+// Number of transforms per batch: a busy session
+#define COUNT 256
+// Batches per measurement
+#define ROUNDS 20000
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float
+frand(void)
+{
+  return rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+static void
+fill(float *data, int count)
+{
+  int i;
+
+  for (i = 0; i < count; ++i) {
+    data[i] = frand();
+  }
+}
+
+static float
+max_diff(float *a, float *b, int count)
+{
+  float d, m = 0.0f;
+  int i;
+
+  for (i = 0; i < count; ++i) {
+    d = fabsf(a[i] - b[i]);
+    m = d > m ? d : m;
+  }
+
+  return m;
+}
+
+static void
+report(const char *name, double scalar, double batch, float diff)
+{
+  double ns = 1e9 / ((double)ROUNDS * COUNT);
+
+  printf("%-22s scalar %7.2f ns  batch %7.2f ns  x%5.2f  (max diff %g)\n",
+         name, scalar * ns, batch * ns, scalar / batch, diff);
+}
+
+int
+main(void)
+{
+  static mat4x4 A, B[COUNT];
+  static vec4 v[COUNT], r0[COUNT], r1[COUNT];
+  static aabb_t box[COUNT], b0[COUNT], b1[COUNT];
+  static int vis0[COUNT], vis1[COUNT];
+  vec4 planes[6];
+  double t0, t1, t2;
+  int i, j, k, visible;
+  float c, e;
+
+  srand(42);
+  fill(&A[0][0], 16);
+  fill(&B[0][0][0], 16 * COUNT);
+  fill(&v[0][0], 4 * COUNT);
+  for (i = 0; i < COUNT; ++i) {
+    for (j = 0; j < 3; ++j) {
+      c = frand() * 20.0f;
+      e = fabsf(frand()) * 2.0f;
+      box[i].min[j] = c - e;
+      box[i].max[j] = c + e;
+    }
+    B[i][0][3] = B[i][1][3] = B[i][2][3] = 0.0f;
+    B[i][3][3] = 1.0f;
+  }
+
+  // mat4x4_mul_vec4
+  t0 = now();
+  for (k = 0; k < ROUNDS; ++k) {
+    for (i = 0; i < COUNT; ++i) {
+      mat4x4_mul_vec4(r0[i], A, v[i]);
+    }
+  }
+  t1 = now();
+  for (k = 0; k < ROUNDS; ++k) {
+    mat4x4_mul_vec4_batch(r1, A, v, COUNT);
+  }
+  t2 = now();
+  report("mat4x4_mul_vec4", t1 - t0, t2 - t1,
+         max_diff(&r0[0][0], &r1[0][0], 4 * COUNT));
+
+  // Bounding boxes: scalar reference transforms the eight corners
+  t0 = now();
+  for (k = 0; k < ROUNDS; ++k) {
+    for (i = 0; i < COUNT; ++i) {
+      vec4 corner, out;
+      for (j = 0; j < 3; ++j) {
+        b0[i].min[j] = 1e30f;
+        b0[i].max[j] = -1e30f;
+      }
+      for (j = 0; j < 8; ++j) {
+        corner[0] = (j & 1) ? box[i].max[0] : box[i].min[0];
+        corner[1] = (j & 2) ? box[i].max[1] : box[i].min[1];
+        corner[2] = (j & 4) ? box[i].max[2] : box[i].min[2];
+        corner[3] = 1.0f;
+        mat4x4_mul_vec4(out, B[i], corner);
+        b0[i].min[0] = out[0] < b0[i].min[0] ? out[0] : b0[i].min[0];
+        b0[i].min[1] = out[1] < b0[i].min[1] ? out[1] : b0[i].min[1];
+        b0[i].min[2] = out[2] < b0[i].min[2] ? out[2] : b0[i].min[2];
+        b0[i].max[0] = out[0] > b0[i].max[0] ? out[0] : b0[i].max[0];
+        b0[i].max[1] = out[1] > b0[i].max[1] ? out[1] : b0[i].max[1];
+        b0[i].max[2] = out[2] > b0[i].max[2] ? out[2] : b0[i].max[2];
+      }
+    }
+  }
+  t1 = now();
+  for (k = 0; k < ROUNDS; ++k) {
+    aabb_transform_batch(b1, B, box, COUNT);
+  }
+  t2 = now();
+  report("aabb_transform", t1 - t0, t2 - t1,
+         max_diff(&b0[0].min[0], &b1[0].min[0], 6 * COUNT));
+
+  // Frustum culling against a perspective camera
+  {
+    mat4x4 proj;
+    mat4x4_perspective(proj, 1.5f, 1.0f, 0.1f, 100.0f);
+    frustum_planes(planes, proj);
+  }
+
+  t0 = now();
+  for (k = 0; k < ROUNDS; ++k) {
+    for (i = 0; i < COUNT; ++i) {
+      vis0[i] = 1;
+      for (j = 0; j < 6 && vis0[i]; ++j) {
+        vec3 c3, e3;
+        int l;
+        for (l = 0; l < 3; ++l) {
+          c3[l] = (box[i].min[l] + box[i].max[l]) * 0.5f;
+          e3[l] = (box[i].max[l] - box[i].min[l]) * 0.5f;
+        }
+        vis0[i] = planes[j][3] + vec3_mul_inner(planes[j], c3) +
+                  fabsf(planes[j][0]) * e3[0] + fabsf(planes[j][1]) * e3[1] +
+                  fabsf(planes[j][2]) * e3[2] >= 0.0f;
+      }
+    }
+  }
+  t1 = now();
+  for (k = 0; k < ROUNDS; ++k) {
+    aabb_cull_batch(vis1, planes, box, COUNT);
+  }
+  t2 = now();
+
+  for (i = visible = 0; i < COUNT; ++i) {
+    visible += vis1[i];
+    if (vis0[i] != vis1[i]) {
+      fprintf(stderr, "aabb_cull: mismatch at %d\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+  report("aabb_cull", t1 - t0, t2 - t1, 0.0f);
+  printf("%d of %d boxes visible\n", visible, COUNT);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture.h"
+
+// -----------------------------------------------------------------------------
+// Writer
+// -----------------------------------------------------------------------------
+static void
+convert(capture_t *c, const unsigned char *bgra)
+{
+  const unsigned char *p, *row;
+  unsigned char *y, *u, *v;
+  int i, j, r, g, b, w = c->width, h = c->height;
+
+  y = c->yuv;
+  u = y + w * h;
+  v = u + (w / 2) * (h / 2);
+
+  // BT.601 full range, rows flipped since GL reads bottom up
+  for (j = 0; j < h; ++j) {
+    row = bgra + (size_t)(h - 1 - j) * w * 4;
+    for (i = 0, p = row; i < w; ++i, p += 4) {
+      b = p[0], g = p[1], r = p[2];
+      *y++ = (77 * r + 150 * g + 29 * b) >> 8;
+
+      // Chroma from the top left pixel of every 2x2 block
+      if (!(i & 1) && !(j & 1)) {
+        *u++ = ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+        *v++ = ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+      }
+    }
+  }
+}
+
+static void *
+capture_thread(void *arg)
+{
+  capture_t *c = (capture_t*)arg;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&c->lock);
+    while (c->running && !c->queue_count) {
+      pthread_cond_wait(&c->cond, &c->lock);
+    }
+    if (!c->queue_count) {
+      pthread_mutex_unlock(&c->lock);
+      break;
+    }
+    i = c->queue_head;
+    pthread_mutex_unlock(&c->lock);
+
+    // Y4M frames carry their capture time as an extension parameter
+    convert(c, c->frames[i]);
+    fprintf(c->file, "FRAME Xts=%.0f\n", c->times[i] * 1e6);
+    fwrite(c->yuv, 1, (size_t)c->width * c->height * 3 / 2, c->file);
+    ++c->written;
+
+    pthread_mutex_lock(&c->lock);
+    c->queue_head = (c->queue_head + 1) % CAPTURE_QUEUE;
+    c->queue_count--;
+    pthread_mutex_unlock(&c->lock);
+  }
+
+  return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Readback
+// -----------------------------------------------------------------------------
+static void
+collect(capture_t *c)
+{
+  capture_slot_t *s;
+  GLenum status;
+  void *src;
+  int full, tail;
+
+  while (c->count > 0) {
+    s = &c->slots[c->head];
+    status = glClientWaitSync(s->fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      break;
+    }
+    glDeleteSync(s->fence);
+    s->fence = 0;
+    c->head = (c->head + 1) % CAPTURE_SLOTS;
+    c->count--;
+
+    pthread_mutex_lock(&c->lock);
+    full = c->queue_count >= CAPTURE_QUEUE;
+    tail = (c->queue_head + c->queue_count) % CAPTURE_QUEUE;
+    pthread_mutex_unlock(&c->lock);
+
+    if (full) {
+      c->dropped++;
+      continue;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s->pbo);
+    if ((src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, c->size,
+                                GL_MAP_READ_BIT)))
+    {
+      memcpy(c->frames[tail], src, c->size);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      c->times[tail] = s->time;
+
+      pthread_mutex_lock(&c->lock);
+      c->queue_count++;
+      pthread_cond_signal(&c->cond);
+      pthread_mutex_unlock(&c->lock);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+int
+capture_init(capture_t *c, const char *path, int width, int height, int rate)
+{
+  int i;
+
+  memset(c, 0, sizeof(capture_t));
+
+  // 4:2:0 needs even dimensions
+  c->width = width & ~1;
+  c->height = height & ~1;
+  c->size = (size_t)c->width * c->height * 4;
+  if (!(c->file = fopen(path, "wb"))) {
+    return 0;
+  }
+  fprintf(c->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+          c->width, c->height, rate);
+
+  for (i = 0; i < CAPTURE_SLOTS; ++i) {
+    glGenBuffers(1, &c->slots[i].pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, c->slots[i].pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, c->size, NULL, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  for (i = 0; i < CAPTURE_QUEUE; ++i) {
+    assert((c->frames[i] = (unsigned char*)malloc(c->size)));
+  }
+  assert((c->yuv = (unsigned char*)malloc((size_t)c->width * c->height * 3 / 2)));
+
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->cond, NULL);
+  c->running = 1;
+  if (pthread_create(&c->thread, NULL, capture_thread, c)) {
+    c->running = 0;
+    capture_destroy(c);
+    return 0;
+  }
+
+  return 1;
+}
+
+void
+capture_frame(capture_t *c, double time)
+{
+  capture_slot_t *s;
+
+  // Hand over whatever the GPU has finished, never waiting for the rest
+  collect(c);
+
+  if (c->count >= CAPTURE_SLOTS) {
+    c->dropped++;
+    return;
+  }
+
+  // Queue the copy of the back buffer; glReadPixels returns at once
+  s = &c->slots[(c->head + c->count) % CAPTURE_SLOTS];
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, s->pbo);
+  glReadBuffer(GL_BACK);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, c->width, c->height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  s->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  s->time = time;
+  c->count++;
+}
+
+void
+capture_destroy(capture_t *c)
+{
+  int i;
+
+  if (c->running) {
+    pthread_mutex_lock(&c->lock);
+    c->running = 0;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->thread, NULL);
+  }
+
+  for (i = 0; i < CAPTURE_SLOTS; ++i) {
+    if (c->slots[i].fence) {
+      glDeleteSync(c->slots[i].fence);
+    }
+    if (c->slots[i].pbo) {
+      glDeleteBuffers(1, &c->slots[i].pbo);
+    }
+  }
+
+  for (i = 0; i < CAPTURE_QUEUE; ++i) {
+    free(c->frames[i]);
+  }
+  free(c->yuv);
+
+  if (c->file) {
+    fclose(c->file);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+  }
+  memset(c, 0, sizeof(capture_t));
+}
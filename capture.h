@@ -0,0 +1,68 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdio.h>
+#include <pthread.h>
+#include <GL/glew.h>
+
+// Readbacks in flight on the GPU
+#define CAPTURE_SLOTS 3
+// Frames waiting for the writer
+#define CAPTURE_QUEUE 4
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct capture_slot_t
+{
+  GLuint            pbo;
+  GLsync            fence;
+  double            time;
+} capture_slot_t;
+
+// Records the frames sent to the headset as a Y4M stream. The back buffer
+// is copied into pixel buffers and only mapped once its fence has passed,
+// so the render thread never waits on the GPU; a writer thread converts
+// and stores the frames. Frames are dropped when either side falls behind.
+typedef struct capture_t
+{
+  FILE             *file;
+  int               width;
+  int               height;
+  size_t            size;
+
+  // Pending readbacks, oldest first
+  capture_slot_t    slots[CAPTURE_SLOTS];
+  int               head;
+  int               count;
+
+  // Frames handed to the writer thread
+  pthread_t         thread;
+  pthread_mutex_t   lock;
+  pthread_cond_t    cond;
+  int               running;
+  unsigned char    *frames[CAPTURE_QUEUE];
+  double            times[CAPTURE_QUEUE];
+  int               queue_head;
+  int               queue_count;
+  unsigned char    *yuv;
+
+  unsigned          written;
+  unsigned          dropped;
+} capture_t;
+
+int capture_init(capture_t *, const char *path, int width, int height,
+                 int rate);
+void capture_frame(capture_t *, double time);
+void capture_destroy(capture_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__CAPTURE_H__*/
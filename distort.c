@@ -0,0 +1,279 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <GL/glew.h>
+#include "riftwm.h"
+#include "distort.h"
+
+// -----------------------------------------------------------------------------
+// DK1 parameters, used when the device does not report its own
+// -----------------------------------------------------------------------------
+static const float DK1_HSIZE     = 0.14976f;
+static const float DK1_VSIZE     = 0.0936f;
+static const float DK1_LENS_SEP  = 0.0635f;
+static const float DK1_K[4]      = { 1.0f, 0.22f, 0.24f, 0.0f };
+static const float DK1_CHROMA[4] = { 0.996f, -0.004f, 1.014f, 0.0f };
+
+static void
+device_getf(riftwm_t *wm, ohmd_float_value key, float *out, float def)
+{
+  if (!wm->rift_dev || ohmd_device_getf(wm->rift_dev, key, out) < 0 ||
+      *out <= 0.0f)
+  {
+    *out = def;
+  }
+}
+
+static float
+distort_poly(distort_t *d, float rsq)
+{
+  return d->k[0] + rsq * (d->k[1] + rsq * (d->k[2] + rsq * d->k[3]));
+}
+
+static void
+hidden_init(distort_t *d)
+{
+  const int N = DISTORT_GRID * 4;
+  float *vert, *v, in[2], out[3][2], *lc, *p, r, best;
+  int eye, i, j, side, step;
+
+  // The edge of the panel, warped into the eye buffer, bounds what the
+  // lens shows. Distortion is radial, so the outline is star shaped around
+  // the lens centre: a strip from it outwards covers everything else.
+  d->hidden_count = (N + 1) * 2;
+  assert((vert = (float*)malloc(sizeof(float) * 2 * d->hidden_count * 2)));
+  v = vert;
+  for (eye = EYE_LEFT; eye <= EYE_RIGHT; ++eye) {
+    lc = d->lens_center[eye];
+    for (i = 0; i <= N; ++i, v += 4) {
+      side = (i % N) / DISTORT_GRID;
+      step = (i % N) % DISTORT_GRID;
+      in[0] = side == 0 ? step : side == 1 ? DISTORT_GRID :
+              side == 2 ? DISTORT_GRID - step : 0;
+      in[1] = side == 0 ? 0 : side == 1 ? step :
+              side == 2 ? DISTORT_GRID : DISTORT_GRID - step;
+      in[0] /= DISTORT_GRID;
+      in[1] /= DISTORT_GRID;
+      distort_warp(d, eye, in, out);
+
+      // Whichever colour channel reaches furthest
+      p = out[0];
+      best = 0.0f;
+      for (j = 0; j < 3; ++j) {
+        r = (out[j][0] - lc[0]) * (out[j][0] - lc[0]) +
+            (out[j][1] - lc[1]) * (out[j][1] - lc[1]);
+        if (r > best) {
+          best = r;
+          p = out[j];
+        }
+      }
+
+      v[0] = lc[0] + (p[0] - lc[0]) * DISTORT_HIDDEN_MARGIN;
+      v[1] = lc[1] + (p[1] - lc[1]) * DISTORT_HIDDEN_MARGIN;
+      v[2] = lc[0] + (p[0] - lc[0]) * 4.0f;
+      v[3] = lc[1] + (p[1] - lc[1]) * 4.0f;
+    }
+  }
+
+  glGenBuffers(1, &d->hidden);
+  glBindBuffer(GL_ARRAY_BUFFER, d->hidden);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * d->hidden_count * 2, vert,
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  free(vert);
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+void
+distort_warp(distort_t *d, eye_t eye, float in[2], float out[3][2])
+{
+  float theta[2], rvec[2], rsq, chroma_r, chroma_b;
+  float *lc = d->lens_center[eye];
+
+  // Scale the output coordinate so that the eye spans [-1, 1] horizontally
+  theta[0] = (in[0] - lc[0]) * 2.0f;
+  theta[1] = (in[1] - lc[1]) * 2.0f / d->aspect;
+  rsq = theta[0] * theta[0] + theta[1] * theta[1];
+
+  rvec[0] = theta[0] * distort_poly(d, rsq) / d->scale;
+  rvec[1] = theta[1] * distort_poly(d, rsq) / d->scale;
+
+  // Red and blue are scaled relative to green
+  chroma_r = d->chroma[0] + d->chroma[1] * rsq;
+  chroma_b = d->chroma[2] + d->chroma[3] * rsq;
+
+  out[0][0] = lc[0] + 0.5f * rvec[0] * chroma_r;
+  out[0][1] = lc[1] + 0.5f * rvec[1] * chroma_r * d->aspect;
+  out[1][0] = lc[0] + 0.5f * rvec[0];
+  out[1][1] = lc[1] + 0.5f * rvec[1] * d->aspect;
+  out[2][0] = lc[0] + 0.5f * rvec[0] * chroma_b;
+  out[2][1] = lc[1] + 0.5f * rvec[1] * chroma_b * d->aspect;
+}
+
+void
+distort_init(distort_t *d, riftwm_t *wm, int width, int height)
+{
+  const int N = DISTORT_GRID + 1;
+  distort_vertex_t *vert, *v;
+  GLushort *idx, *i;
+  float lc, in[2], out[3][2], fit;
+  int eye, x, y, base;
+
+  memset(d, 0, sizeof(distort_t));
+
+  // Query the device, falling back to the DK1 where it is silent
+  device_getf(wm, OHMD_SCREEN_HORIZONTAL_SIZE, &d->hsize, DK1_HSIZE);
+  device_getf(wm, OHMD_SCREEN_VERTICAL_SIZE, &d->vsize, DK1_VSIZE);
+  device_getf(wm, OHMD_LENS_HORIZONTAL_SEPARATION, &d->lens_sep, DK1_LENS_SEP);
+  device_getf(wm, OHMD_LENS_VERTICAL_POSITION, &d->lens_vpos, d->vsize / 2.0f);
+
+  float k[6] = { 0.0f };
+  if (wm->rift_dev && ohmd_device_getf(wm->rift_dev, OHMD_DISTORTION_K, k) >= 0
+      && k[0] > 0.0f)
+  {
+    memcpy(d->k, k, sizeof(d->k));
+  } else {
+    memcpy(d->k, DK1_K, sizeof(d->k));
+  }
+  memcpy(d->chroma, DK1_CHROMA, sizeof(d->chroma));
+
+  // Lens centres in eye viewport coordinates, right one mirrored
+  d->width = width;
+  d->height = height;
+  d->aspect = (width / 2.0f) / (float)height;
+
+  lc = 1.0f - d->lens_sep / d->hsize;
+  d->lens_center[EYE_LEFT][0] = lc;
+  d->lens_center[EYE_LEFT][1] = d->lens_vpos / d->vsize;
+  d->lens_center[EYE_RIGHT][0] = 1.0f - lc;
+  d->lens_center[EYE_RIGHT][1] = d->lens_vpos / d->vsize;
+
+  // Fit the outer edge of the eye viewport into the rendered image
+  fit = 2.0f * lc;
+  d->scale = distort_poly(d, fit * fit);
+
+  // Build the two grids
+  assert((vert = (distort_vertex_t*)malloc(sizeof(distort_vertex_t) * N * N * 2)));
+  assert((idx = (GLushort*)malloc(sizeof(GLushort) * DISTORT_GRID *
+                                  DISTORT_GRID * 6 * 2)));
+
+  v = vert;
+  i = idx;
+  for (eye = EYE_LEFT; eye <= EYE_RIGHT; ++eye) {
+    base = eye * N * N;
+    for (y = 0; y < N; ++y) {
+      for (x = 0; x < N; ++x, ++v) {
+        in[0] = x / (float)DISTORT_GRID;
+        in[1] = y / (float)DISTORT_GRID;
+        distort_warp(d, eye, in, out);
+
+        v->pos[0] = in[0] - (eye == EYE_LEFT ? 1.0f : 0.0f);
+        v->pos[1] = in[1] * 2.0f - 1.0f;
+        memcpy(v->tc_r, out[0], sizeof(v->tc_r));
+        memcpy(v->tc_g, out[1], sizeof(v->tc_g));
+        memcpy(v->tc_b, out[2], sizeof(v->tc_b));
+      }
+    }
+
+    for (y = 0; y < DISTORT_GRID; ++y) {
+      for (x = 0; x < DISTORT_GRID; ++x) {
+        *i++ = base + (y + 0) * N + (x + 0);
+        *i++ = base + (y + 0) * N + (x + 1);
+        *i++ = base + (y + 1) * N + (x + 1);
+        *i++ = base + (y + 0) * N + (x + 0);
+        *i++ = base + (y + 1) * N + (x + 1);
+        *i++ = base + (y + 1) * N + (x + 0);
+      }
+    }
+  }
+
+  d->index_count = DISTORT_GRID * DISTORT_GRID * 6;
+
+  glGenBuffers(1, &d->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, d->vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(distort_vertex_t) * N * N * 2, vert,
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glGenBuffers(1, &d->ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, d->ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * d->index_count * 2,
+               idx, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  free(vert);
+  free(idx);
+
+  hidden_init(d);
+}
+
+void
+distort_draw(distort_t *d, eye_t eye, GLint a_pos, GLint a_tc_r,
+             GLint a_tc_g, GLint a_tc_b)
+{
+  const GLsizei stride = sizeof(distort_vertex_t);
+
+  glBindBuffer(GL_ARRAY_BUFFER, d->vbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, d->ibo);
+
+  glEnableVertexAttribArray(a_pos);
+  glEnableVertexAttribArray(a_tc_r);
+  glEnableVertexAttribArray(a_tc_g);
+  glEnableVertexAttribArray(a_tc_b);
+  glVertexAttribPointer(a_pos, 2, GL_FLOAT, GL_FALSE, stride,
+                        (void*)offsetof(distort_vertex_t, pos));
+  glVertexAttribPointer(a_tc_r, 2, GL_FLOAT, GL_FALSE, stride,
+                        (void*)offsetof(distort_vertex_t, tc_r));
+  glVertexAttribPointer(a_tc_g, 2, GL_FLOAT, GL_FALSE, stride,
+                        (void*)offsetof(distort_vertex_t, tc_g));
+  glVertexAttribPointer(a_tc_b, 2, GL_FLOAT, GL_FALSE, stride,
+                        (void*)offsetof(distort_vertex_t, tc_b));
+
+  glDrawElements(GL_TRIANGLES, d->index_count, GL_UNSIGNED_SHORT,
+                 (void*)(sizeof(GLushort) * d->index_count * eye));
+
+  glDisableVertexAttribArray(a_pos);
+  glDisableVertexAttribArray(a_tc_r);
+  glDisableVertexAttribArray(a_tc_g);
+  glDisableVertexAttribArray(a_tc_b);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void
+distort_hide(distort_t *d, eye_t eye)
+{
+  glBindBuffer(GL_ARRAY_BUFFER, d->hidden);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, 0);
+  glDrawArrays(GL_TRIANGLE_STRIP, d->hidden_count * eye, d->hidden_count);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void
+distort_destroy(distort_t *d)
+{
+  if (d->vbo) {
+    glDeleteBuffers(1, &d->vbo);
+    d->vbo = 0;
+  }
+
+  if (d->ibo) {
+    glDeleteBuffers(1, &d->ibo);
+    d->ibo = 0;
+  }
+
+  if (d->hidden) {
+    glDeleteBuffers(1, &d->hidden);
+    d->hidden = 0;
+  }
+}
@@ -0,0 +1,60 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __DISTORT_H__
+#define __DISTORT_H__
+
+// Number of quads along each side of the per-eye warp grid
+#define DISTORT_GRID 32
+// Slack around the visible part of the eye buffer, left for timewarp
+#define DISTORT_HIDDEN_MARGIN 1.05f
+
+typedef enum
+{
+  EYE_LEFT  = 0,
+  EYE_RIGHT = 1
+} eye_t;
+
+typedef struct distort_vertex_t
+{
+  float             pos[2];
+  float             tc_r[2];
+  float             tc_g[2];
+  float             tc_b[2];
+} distort_vertex_t;
+
+typedef struct distort_t
+{
+  // Device properties
+  float             hsize;
+  float             vsize;
+  float             lens_sep;
+  float             lens_vpos;
+  float             k[4];
+  float             chroma[4];
+
+  // Derived parameters, in eye viewport coordinates
+  int               width;
+  int               height;
+  float             aspect;
+  float             lens_center[2][2];
+  float             scale;
+
+  // Warp mesh: one grid per eye, sharing the vertex buffer
+  GLuint            vbo;
+  GLuint            ibo;
+  int               index_count;
+
+  // Ring around the texels the warp never samples, as a strip per eye
+  GLuint            hidden;
+  int               hidden_count;
+} distort_t;
+
+void distort_init(distort_t *, riftwm_t *, int width, int height);
+void distort_warp(distort_t *, eye_t, float in[2], float out[3][2]);
+void distort_draw(distort_t *, eye_t, GLint a_pos, GLint a_tc_r,
+                  GLint a_tc_g, GLint a_tc_b);
+void distort_hide(distort_t *, eye_t);
+void distort_destroy(distort_t *);
+
+#endif /*__DISTORT_H__*/
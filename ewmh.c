@@ -0,0 +1,351 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
+#include "riftwm.h"
+#include "ewmh.h"
+
+static char *ATOM_NAMES[EWMH_ATOM_COUNT] =
+{
+  [EWMH_NET_WM_NAME]                     = "_NET_WM_NAME",
+  [EWMH_WM_NAME]                         = "WM_NAME",
+  [EWMH_WM_CLASS]                        = "WM_CLASS",
+  [EWMH_WM_TRANSIENT_FOR]                = "WM_TRANSIENT_FOR",
+  [EWMH_NET_WM_WINDOW_TYPE]              = "_NET_WM_WINDOW_TYPE",
+  [EWMH_NET_WM_STATE]                    = "_NET_WM_STATE",
+  [EWMH_RIFTWM_MAX_FPS]                  = "_RIFTWM_MAX_FPS",
+  [EWMH_UTF8_STRING]                     = "UTF8_STRING",
+  [EWMH_NET_SUPPORTED]                   = "_NET_SUPPORTED",
+  [EWMH_NET_SUPPORTING_WM_CHECK]         = "_NET_SUPPORTING_WM_CHECK",
+  [EWMH_NET_WM_WINDOW_TYPE_NORMAL]       = "_NET_WM_WINDOW_TYPE_NORMAL",
+  [EWMH_NET_WM_WINDOW_TYPE_DIALOG]       = "_NET_WM_WINDOW_TYPE_DIALOG",
+  [EWMH_NET_WM_WINDOW_TYPE_UTILITY]      = "_NET_WM_WINDOW_TYPE_UTILITY",
+  [EWMH_NET_WM_WINDOW_TYPE_TOOLBAR]      = "_NET_WM_WINDOW_TYPE_TOOLBAR",
+  [EWMH_NET_WM_WINDOW_TYPE_SPLASH]       = "_NET_WM_WINDOW_TYPE_SPLASH",
+  [EWMH_NET_WM_WINDOW_TYPE_MENU]         = "_NET_WM_WINDOW_TYPE_MENU",
+  [EWMH_NET_WM_WINDOW_TYPE_DROPDOWN_MENU]= "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU",
+  [EWMH_NET_WM_WINDOW_TYPE_POPUP_MENU]   = "_NET_WM_WINDOW_TYPE_POPUP_MENU",
+  [EWMH_NET_WM_WINDOW_TYPE_COMBO]        = "_NET_WM_WINDOW_TYPE_COMBO",
+  [EWMH_NET_WM_WINDOW_TYPE_TOOLTIP]      = "_NET_WM_WINDOW_TYPE_TOOLTIP",
+  [EWMH_NET_WM_WINDOW_TYPE_NOTIFICATION] = "_NET_WM_WINDOW_TYPE_NOTIFICATION",
+  [EWMH_NET_WM_WINDOW_TYPE_DOCK]         = "_NET_WM_WINDOW_TYPE_DOCK",
+  [EWMH_NET_WM_STATE_MODAL]              = "_NET_WM_STATE_MODAL",
+};
+
+// Hints advertised in _NET_SUPPORTED. _NET_WM_STATE is only read for
+// placement: its client messages are not handled, so it is left out.
+static const int SUPPORTED[] =
+{
+  EWMH_NET_SUPPORTED,
+  EWMH_NET_SUPPORTING_WM_CHECK,
+  EWMH_NET_WM_NAME,
+  EWMH_NET_WM_WINDOW_TYPE,
+  EWMH_NET_WM_WINDOW_TYPE_NORMAL,
+  EWMH_NET_WM_WINDOW_TYPE_DIALOG,
+  EWMH_NET_WM_WINDOW_TYPE_UTILITY,
+  EWMH_NET_WM_WINDOW_TYPE_TOOLBAR,
+  EWMH_NET_WM_WINDOW_TYPE_SPLASH,
+  EWMH_NET_WM_WINDOW_TYPE_MENU,
+  EWMH_NET_WM_WINDOW_TYPE_DROPDOWN_MENU,
+  EWMH_NET_WM_WINDOW_TYPE_POPUP_MENU,
+  EWMH_NET_WM_WINDOW_TYPE_COMBO,
+  EWMH_NET_WM_WINDOW_TYPE_TOOLTIP,
+  EWMH_NET_WM_WINDOW_TYPE_NOTIFICATION,
+  EWMH_NET_WM_WINDOW_TYPE_DOCK
+};
+#define SUPPORTED_COUNT (int)(sizeof(SUPPORTED) / sizeof(SUPPORTED[0]))
+
+// Longest read of each property, in 32-bit units
+static const uint32_t PROP_LENGTHS[EWMH_PROP_COUNT] =
+{
+  [EWMH_NET_WM_NAME]        = 64,
+  [EWMH_WM_NAME]            = 64,
+  [EWMH_WM_CLASS]           = 64,
+  [EWMH_WM_TRANSIENT_FOR]   = 1,
+  [EWMH_NET_WM_WINDOW_TYPE] = 16,
+  [EWMH_NET_WM_STATE]       = 16,
+  [EWMH_RIFTWM_MAX_FPS]     = 1,
+};
+
+// -----------------------------------------------------------------------------
+// Internal stuff
+// -----------------------------------------------------------------------------
+static void
+set_string(char **str, const char *data, int len)
+{
+  free(*str);
+  *str = NULL;
+  if (len > 0) {
+    assert((*str = (char*)malloc(len + 1)));
+    memcpy(*str, data, len);
+    (*str)[len] = '\0';
+  }
+}
+
+static uint32_t
+read_card(xcb_get_property_reply_t *reply)
+{
+  if (reply->format != 32 || xcb_get_property_value_length(reply) < 4) {
+    return 0;
+  }
+  return *(uint32_t*)xcb_get_property_value(reply);
+}
+
+static ewmh_type_t
+read_type(ewmh_t *e, xcb_get_property_reply_t *reply)
+{
+  const uint32_t *atoms = (const uint32_t*)xcb_get_property_value(reply);
+  int i, count;
+
+  if (reply->format != 32) {
+    return EWMH_TYPE_UNKNOWN;
+  }
+
+  // Types are listed by preference, the first one known wins
+  count = xcb_get_property_value_length(reply) / 4;
+  for (i = 0; i < count; ++i) {
+    if (atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_NORMAL]) {
+      return EWMH_TYPE_NORMAL;
+    }
+    if (atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_DIALOG] ||
+        atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_UTILITY] ||
+        atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_TOOLBAR] ||
+        atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_SPLASH])
+    {
+      return EWMH_TYPE_DIALOG;
+    }
+    if (atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_MENU] ||
+        atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_DROPDOWN_MENU] ||
+        atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_POPUP_MENU] ||
+        atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_COMBO] ||
+        atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_TOOLTIP] ||
+        atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_NOTIFICATION])
+    {
+      return EWMH_TYPE_MENU;
+    }
+    if (atoms[i] == e->atoms[EWMH_NET_WM_WINDOW_TYPE_DOCK]) {
+      return EWMH_TYPE_DOCK;
+    }
+  }
+
+  return EWMH_TYPE_UNKNOWN;
+}
+
+static unsigned
+read_state(ewmh_t *e, xcb_get_property_reply_t *reply)
+{
+  const uint32_t *atoms = (const uint32_t*)xcb_get_property_value(reply);
+  unsigned state = 0;
+  int i, count;
+
+  if (reply->format != 32) {
+    return 0;
+  }
+
+  count = xcb_get_property_value_length(reply) / 4;
+  for (i = 0; i < count; ++i) {
+    if (atoms[i] == e->atoms[EWMH_NET_WM_STATE_MODAL]) {
+      state |= EWMH_STATE_MODAL;
+    }
+  }
+
+  return state;
+}
+
+static void
+read_prop(ewmh_t *e, riftwin_t *win, int prop, xcb_get_property_reply_t *reply,
+          int *named)
+{
+  const char *data;
+  int len, n;
+
+  data = reply ? (const char*)xcb_get_property_value(reply) : NULL;
+  len = reply && reply->format == 8 ? xcb_get_property_value_length(reply) : 0;
+
+  switch (prop) {
+    case EWMH_NET_WM_NAME:
+    {
+      // WM_NAME is read in the same batch, for clients without this one
+      if ((*named = len > 0)) {
+        set_string(&win->name, data, len);
+      }
+      break;
+    }
+    case EWMH_WM_NAME:
+    {
+      if (!*named) {
+        set_string(&win->name, data, len);
+      }
+      break;
+    }
+    case EWMH_WM_CLASS:
+    {
+      // Instance and class, each terminated by a null: keep the class
+      n = len > 0 ? strnlen(data, len) : 0;
+      if (n + 1 < len) {
+        set_string(&win->wm_class, data + n + 1,
+                   strnlen(data + n + 1, len - n - 1));
+      } else {
+        set_string(&win->wm_class, data, n);
+      }
+      break;
+    }
+    case EWMH_WM_TRANSIENT_FOR:
+    {
+      win->transient_for = reply ? read_card(reply) : None;
+      break;
+    }
+    case EWMH_NET_WM_WINDOW_TYPE:
+    {
+      win->type = reply ? read_type(e, reply) : EWMH_TYPE_UNKNOWN;
+      break;
+    }
+    case EWMH_NET_WM_STATE:
+    {
+      win->state = reply ? read_state(e, reply) : 0;
+      break;
+    }
+    case EWMH_RIFTWM_MAX_FPS:
+    {
+      win->max_fps = reply ? (float)read_card(reply) : 0.0f;
+      break;
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+int
+ewmh_init(ewmh_t *e, Display *dpy, Window root, Window parent)
+{
+  Atom supported[SUPPORTED_COUNT];
+  int i;
+
+  memset(e, 0, sizeof(ewmh_t));
+  e->dpy = dpy;
+  e->conn = XGetXCBConnection(dpy);
+  e->root = root;
+
+  // One round trip for all the atoms
+  if (!XInternAtoms(dpy, ATOM_NAMES, EWMH_ATOM_COUNT, False, e->atoms)) {
+    return 0;
+  }
+
+  // Tell clients which hints are honoured and that a wm is running. The
+  // check window is kept out of the managed windows, like the spectator.
+  for (i = 0; i < SUPPORTED_COUNT; ++i) {
+    supported[i] = e->atoms[SUPPORTED[i]];
+  }
+  XChangeProperty(dpy, root, e->atoms[EWMH_NET_SUPPORTED], XA_ATOM, 32,
+                  PropModeReplace, (unsigned char*)supported,
+                  SUPPORTED_COUNT);
+
+  e->check = XCreateSimpleWindow(dpy, parent, -1, -1, 1, 1, 0, 0, 0);
+  XChangeProperty(dpy, e->check, e->atoms[EWMH_NET_WM_NAME],
+                  e->atoms[EWMH_UTF8_STRING], 8, PropModeReplace,
+                  (unsigned char*)"riftwm", 6);
+  XChangeProperty(dpy, e->check, e->atoms[EWMH_NET_SUPPORTING_WM_CHECK],
+                  XA_WINDOW, 32, PropModeReplace,
+                  (unsigned char*)&e->check, 1);
+  XChangeProperty(dpy, root, e->atoms[EWMH_NET_SUPPORTING_WM_CHECK],
+                  XA_WINDOW, 32, PropModeReplace,
+                  (unsigned char*)&e->check, 1);
+
+  return 1;
+}
+
+void
+ewmh_invalidate(ewmh_t *e, riftwin_t *win, Atom atom)
+{
+  int i;
+
+  for (i = 0; i < EWMH_PROP_COUNT; ++i) {
+    if (e->atoms[i] == atom) {
+      win->props_pending |= 1u << i;
+    }
+  }
+
+  // Both names are read together to know which one to show
+  if (win->props_pending & ((1u << EWMH_NET_WM_NAME) | (1u << EWMH_WM_NAME))) {
+    win->props_pending |= (1u << EWMH_NET_WM_NAME) | (1u << EWMH_WM_NAME);
+  }
+}
+
+int
+ewmh_fetch(ewmh_t *e, riftwin_t *windows)
+{
+  xcb_get_property_reply_t *reply;
+  xcb_generic_error_t *err;
+  ewmh_request_t *r;
+  riftwin_t *win;
+  int i, n = 0, named = 0;
+
+  // Send every read before waiting for the first reply
+  for (win = windows; win; win = win->next) {
+    for (i = 0; i < EWMH_PROP_COUNT && win->props_pending; ++i) {
+      if (!(win->props_pending & (1u << i))) {
+        continue;
+      }
+      if (n >= e->request_cap) {
+        e->request_cap = e->request_cap ? (e->request_cap << 1) : 64;
+        assert((e->requests = (ewmh_request_t*)realloc(e->requests,
+                              sizeof(ewmh_request_t) * e->request_cap)));
+      }
+
+      r = &e->requests[n++];
+      r->win = win;
+      r->prop = i;
+      r->cookie = xcb_get_property(e->conn, 0, win->window, e->atoms[i],
+                                   XCB_GET_PROPERTY_TYPE_ANY, 0,
+                                   PROP_LENGTHS[i]);
+    }
+    win->props_pending = 0;
+  }
+
+  // Requests of a window are consecutive, in property order. Windows gone
+  // in the meantime answer with an error, read as a missing property.
+  for (i = 0; i < n; ++i) {
+    r = &e->requests[i];
+    err = NULL;
+    reply = xcb_get_property_reply(e->conn, r->cookie, &err);
+    if (reply && reply->type == XCB_NONE) {
+      free(reply);
+      reply = NULL;
+    }
+
+    read_prop(e, r->win, r->prop, reply, &named);
+    free(reply);
+    free(err);
+  }
+
+  return n;
+}
+
+ewmh_type_t
+ewmh_type(riftwin_t *win)
+{
+  // Without a type, transients are dialogs and the rest normal windows
+  if (win->type == EWMH_TYPE_UNKNOWN) {
+    return win->transient_for ? EWMH_TYPE_DIALOG : EWMH_TYPE_NORMAL;
+  }
+  if (win->type == EWMH_TYPE_NORMAL && (win->state & EWMH_STATE_MODAL)) {
+    return EWMH_TYPE_DIALOG;
+  }
+  return win->type;
+}
+
+void
+ewmh_destroy(ewmh_t *e)
+{
+  if (e->check) {
+    XDeleteProperty(e->dpy, e->root, e->atoms[EWMH_NET_SUPPORTING_WM_CHECK]);
+    XDestroyWindow(e->dpy, e->check);
+  }
+  free(e->requests);
+  memset(e, 0, sizeof(ewmh_t));
+}
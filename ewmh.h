@@ -0,0 +1,96 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __EWMH_H__
+#define __EWMH_H__
+
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Atoms interned at startup. The first EWMH_PROP_COUNT are the properties
+// read from every window, in the order of their pending bits.
+typedef enum
+{
+  EWMH_NET_WM_NAME,
+  EWMH_WM_NAME,
+  EWMH_WM_CLASS,
+  EWMH_WM_TRANSIENT_FOR,
+  EWMH_NET_WM_WINDOW_TYPE,
+  EWMH_NET_WM_STATE,
+  EWMH_RIFTWM_MAX_FPS,
+  EWMH_PROP_COUNT,
+
+  EWMH_UTF8_STRING = EWMH_PROP_COUNT,
+  EWMH_NET_SUPPORTED,
+  EWMH_NET_SUPPORTING_WM_CHECK,
+  EWMH_NET_WM_WINDOW_TYPE_NORMAL,
+  EWMH_NET_WM_WINDOW_TYPE_DIALOG,
+  EWMH_NET_WM_WINDOW_TYPE_UTILITY,
+  EWMH_NET_WM_WINDOW_TYPE_TOOLBAR,
+  EWMH_NET_WM_WINDOW_TYPE_SPLASH,
+  EWMH_NET_WM_WINDOW_TYPE_MENU,
+  EWMH_NET_WM_WINDOW_TYPE_DROPDOWN_MENU,
+  EWMH_NET_WM_WINDOW_TYPE_POPUP_MENU,
+  EWMH_NET_WM_WINDOW_TYPE_COMBO,
+  EWMH_NET_WM_WINDOW_TYPE_TOOLTIP,
+  EWMH_NET_WM_WINDOW_TYPE_NOTIFICATION,
+  EWMH_NET_WM_WINDOW_TYPE_DOCK,
+  EWMH_NET_WM_STATE_MODAL,
+  EWMH_ATOM_COUNT
+} ewmh_atom_t;
+
+// Pending bits of a window that has not been read yet
+#define EWMH_PROPS_ALL ((1u << EWMH_PROP_COUNT) - 1)
+// _NET_WM_STATE flags
+#define EWMH_STATE_MODAL 0x1
+
+// How a window is placed, from its window type, transient and state hints
+typedef enum
+{
+  EWMH_TYPE_UNKNOWN,
+  EWMH_TYPE_NORMAL,
+  EWMH_TYPE_DIALOG,
+  EWMH_TYPE_MENU,
+  EWMH_TYPE_DOCK
+} ewmh_type_t;
+
+// Property read in flight
+typedef struct ewmh_request_t
+{
+  struct riftwin_t         *win;
+  int                       prop;
+  xcb_get_property_cookie_t cookie;
+} ewmh_request_t;
+
+// Window properties are only read when a window is created and when a
+// PropertyNotify invalidates one. ewmh_fetch sends the reads of all the
+// invalidated properties of all windows before waiting for any reply, so
+// a tick costs one round trip however many windows changed.
+typedef struct ewmh_t
+{
+  Display                  *dpy;
+  xcb_connection_t         *conn;
+  Window                    root;
+  Window                    check;
+  Atom                      atoms[EWMH_ATOM_COUNT];
+
+  ewmh_request_t           *requests;
+  int                       request_cap;
+} ewmh_t;
+
+int ewmh_init(ewmh_t *, Display *, Window root, Window parent);
+void ewmh_invalidate(ewmh_t *, struct riftwin_t *, Atom);
+int ewmh_fetch(ewmh_t *, struct riftwin_t *windows);
+ewmh_type_t ewmh_type(struct riftwin_t *);
+void ewmh_destroy(ewmh_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__EWMH_H__*/
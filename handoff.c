@@ -0,0 +1,245 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <GL/glew.h>
+#include "riftwm.h"
+#include "renderer.h"
+#include "kinect.h"
+#include "handoff.h"
+
+// -----------------------------------------------------------------------------
+// Serialisation
+// -----------------------------------------------------------------------------
+typedef struct handoff_header_t
+{
+  uint32_t          magic;
+  uint32_t          version;
+  uint32_t          state_size;
+  uint32_t          window_size;
+  uint32_t          window_count;
+  uint32_t          texture_count;
+} handoff_header_t;
+
+static int
+write_all(int fd, const void *data, size_t size)
+{
+  const char *ptr = (const char*)data;
+  ssize_t n;
+
+  while (size > 0) {
+    if ((n = write(fd, ptr, size)) <= 0) {
+      return 0;
+    }
+    ptr += n;
+    size -= n;
+  }
+
+  return 1;
+}
+
+static int
+read_all(int fd, void *data, size_t size)
+{
+  char *ptr = (char*)data;
+  ssize_t n;
+
+  while (size > 0) {
+    if ((n = read(fd, ptr, size)) <= 0) {
+      return 0;
+    }
+    ptr += n;
+    size -= n;
+  }
+
+  return 1;
+}
+
+static int
+save_texture(int fd, texture_t *tex)
+{
+  handoff_tex_t ht;
+  size_t size;
+  int ok;
+
+  memset(&ht, 0, sizeof(ht));
+  strncpy(ht.name, tex->src, sizeof(ht.name) - 1);
+  ht.width = tex->width;
+  ht.height = tex->height;
+
+  size = (size_t)tex->width * tex->height * 4;
+  if (!(ht.data = (unsigned char*)malloc(size))) {
+    return 0;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, tex->tex);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, ht.data);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  ok = write_all(fd, ht.name, sizeof(ht.name)) &&
+       write_all(fd, &ht.width, sizeof(ht.width)) &&
+       write_all(fd, &ht.height, sizeof(ht.height)) &&
+       write_all(fd, ht.data, size);
+
+  free(ht.data);
+  return ok;
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+int
+handoff_save(riftwm_t *wm)
+{
+  renderer_t *r = wm->renderer;
+  handoff_header_t hdr;
+  handoff_t h;
+  handoff_win_t hw;
+  riftwin_t *win;
+  int fd, i, ok;
+
+  if ((fd = memfd_create("riftwm-handoff", 0)) < 0) {
+    return -1;
+  }
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.pos, r->pos, sizeof(vec3));
+  memcpy(h.dir, r->dir, sizeof(vec3));
+  h.rot_x = r->rot_x;
+  h.rot_y = r->rot_y;
+  h.workspace = wm->workspace;
+  h.rift_devices = wm->has_rift;
+  h.saved_at = riftwm_time();
+  h.has_origin = r->has_origin;
+  memcpy(h.origin, r->origin, sizeof(h.origin));
+  if (wm->kinect) {
+    kinect_calibration(wm->kinect, h.shift);
+  }
+
+  hdr.magic = HANDOFF_MAGIC;
+  hdr.version = HANDOFF_VERSION;
+  hdr.state_size = sizeof(handoff_t);
+  hdr.window_size = sizeof(handoff_win_t);
+  hdr.window_count = wm->window_count;
+  hdr.texture_count = r->texture_count;
+
+  ok = write_all(fd, &hdr, sizeof(hdr)) && write_all(fd, &h, sizeof(h));
+
+  for (win = wm->windows; ok && win; win = win->next) {
+    memset(&hw, 0, sizeof(hw));
+    hw.window = win->window;
+    hw.cell = win->cell;
+    hw.workspace = win->workspace;
+    hw.focused = win->focused;
+    ok = write_all(fd, &hw, sizeof(hw));
+  }
+
+  for (i = 0; ok && i < r->texture_count; ++i) {
+    ok = save_texture(fd, &r->textures[i]);
+  }
+
+  if (!ok || lseek(fd, 0, SEEK_SET) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+handoff_t *
+handoff_load(int fd)
+{
+  handoff_header_t hdr;
+  handoff_tex_t *ht;
+  handoff_t *h;
+  size_t size;
+  int i, ok;
+
+  // The binary may have been rebuilt since: reject other layouts
+  if (!read_all(fd, &hdr, sizeof(hdr)) || hdr.magic != HANDOFF_MAGIC ||
+      hdr.version != HANDOFF_VERSION || hdr.state_size != sizeof(handoff_t) ||
+      hdr.window_size != sizeof(handoff_win_t))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  assert((h = (handoff_t*)malloc(sizeof(handoff_t))));
+  ok = read_all(fd, h, sizeof(handoff_t));
+  h->window_count = hdr.window_count;
+  h->texture_count = hdr.texture_count;
+  h->windows = (handoff_win_t*)calloc(h->window_count + 1, sizeof(handoff_win_t));
+  h->textures = (handoff_tex_t*)calloc(h->texture_count + 1, sizeof(handoff_tex_t));
+  assert(h->windows && h->textures);
+
+  ok = ok && read_all(fd, h->windows, sizeof(handoff_win_t) * h->window_count);
+  for (i = 0; ok && i < h->texture_count; ++i) {
+    ht = &h->textures[i];
+    ok = read_all(fd, ht->name, sizeof(ht->name)) &&
+         read_all(fd, &ht->width, sizeof(ht->width)) &&
+         read_all(fd, &ht->height, sizeof(ht->height));
+
+    size = (size_t)ht->width * ht->height * 4;
+    ok = ok && (ht->data = (unsigned char*)malloc(size)) &&
+         read_all(fd, ht->data, size);
+    ht->name[sizeof(ht->name) - 1] = '\0';
+  }
+
+  close(fd);
+  if (!ok) {
+    handoff_free(h);
+    return NULL;
+  }
+
+  return h;
+}
+
+handoff_win_t *
+handoff_find_window(handoff_t *h, Window window)
+{
+  int i;
+
+  for (i = 0; h && i < h->window_count; ++i) {
+    if (h->windows[i].window == window) {
+      return &h->windows[i];
+    }
+  }
+
+  return NULL;
+}
+
+handoff_tex_t *
+handoff_find_texture(handoff_t *h, const char *name)
+{
+  int i;
+
+  for (i = 0; h && i < h->texture_count; ++i) {
+    if (!strcmp(h->textures[i].name, name)) {
+      return &h->textures[i];
+    }
+  }
+
+  return NULL;
+}
+
+void
+handoff_free(handoff_t *h)
+{
+  int i;
+
+  if (h) {
+    for (i = 0; i < h->texture_count; ++i) {
+      free(h->textures[i].data);
+    }
+    free(h->textures);
+    free(h->windows);
+    free(h);
+  }
+}
@@ -0,0 +1,59 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __HANDOFF_H__
+#define __HANDOFF_H__
+
+#define HANDOFF_MAGIC   0x48575652
+#define HANDOFF_VERSION 4
+
+// State of a managed window carried across a restart
+typedef struct handoff_win_t
+{
+  Window            window;
+  int               cell;
+  int               workspace;
+  int               focused;
+} handoff_win_t;
+
+// Decoded environment texture, saves the image loaders on restart
+typedef struct handoff_tex_t
+{
+  char              name[64];
+  int               width;
+  int               height;
+  unsigned char    *data;
+} handoff_tex_t;
+
+typedef struct handoff_t
+{
+  // Renderer pose
+  vec3              pos;
+  vec3              dir;
+  float             rot_x;
+  float             rot_y;
+  int               workspace;
+
+  // Headsets found by the last probe, none means the restart skips it
+  int               rift_devices;
+  // Monotonic time of the save, to report how long the restart took
+  double            saved_at;
+
+  // Tracker calibration
+  int               has_origin;
+  float             origin[3];
+  float             shift[3];
+
+  handoff_win_t    *windows;
+  int               window_count;
+  handoff_tex_t    *textures;
+  int               texture_count;
+} handoff_t;
+
+int handoff_save(riftwm_t *);
+handoff_t *handoff_load(int fd);
+handoff_win_t *handoff_find_window(handoff_t *, Window);
+handoff_tex_t *handoff_find_texture(handoff_t *, const char *);
+void handoff_free(handoff_t *);
+
+#endif /*__HANDOFF_H__*/
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <OpenNI.h>
 #include <NiTE.h>
 #include "riftwm.h"
@@ -30,6 +31,19 @@ typedef struct kinect_t
 
   float x_shift,y_shift,z_shift;
   smooth_t       s_pos;
+
+  // Latest head position, smoothed by kinect_step at the simulation rate
+  float          head[3];
+  bool           tracked;
+
+  // Depth map of the last frame, kept referenced for the passthrough
+  openni::VideoFrameRef depth;
+
+  // OpenNI and NiTE take seconds to start: they are brought up in the
+  // background and the tracker is ignored until ready is set
+  pthread_t      thread;
+  volatile int   ready;
+  const char    *error;
 } kinect_t;
 
 static void
@@ -68,48 +82,104 @@ smooth_get(smooth_t *s, float *x, float *y, float *z)
     }
   }
 
-  *z = acc[0] / count;
+  *x = acc[0] / count;
   *y = acc[1] / count;
   *z = acc[2] / count;
 }
 
-kinect_t *
-kinect_init(riftwm_t * wm)
+static void *
+kinect_thread(void *arg)
 {
-  kinect_t *k;
-  k = new kinect_t;
-  k->wm = wm;
-  k->r = wm->renderer;
+  kinect_t *k = (kinect_t*)arg;
 
   if (openni::OpenNI::initialize() != openni::STATUS_OK)
   {
-    riftwm_error(wm,"Couldnt initialize OpenNI");
+    k->error = "Couldnt initialize OpenNI";
+    k->ready = -1;
+    return NULL;
   }
   if (nite::NiTE::initialize() != nite::STATUS_OK)
   {
-    riftwm_error(wm,"Couldnt initialize NiTE");
+    k->error = "Couldnt initialize NiTE";
+    k->ready = -1;
+    return NULL;
   }
 
   k->tracker = new nite::UserTracker();
   if ( k->tracker->create() != nite::STATUS_OK)
   {
-    riftwm_error(wm,"Couldnt initialize UserTracker");
+    k->error = "Couldnt initialize UserTracker";
+    k->ready = -1;
+    return NULL;
   }
 
+  __sync_synchronize();
+  k->ready = 1;
+  return NULL;
+}
+
+kinect_t *
+kinect_init(riftwm_t * wm)
+{
+  kinect_t *k;
+  k = new kinect_t;
+  k->wm = wm;
+  k->r = wm->renderer;
+  k->tracker = NULL;
+  k->ready = 0;
+  k->error = NULL;
+
   k->x_shift = 0.0f;
   k->y_shift = 0.0f;
   k->z_shift = 0.0f;
+  k->s_pos.index = 0;
   k->s_pos.wrap = 0;
 
   k->found = false;
+  k->tracked = false;
+
+  if (pthread_create(&k->thread, NULL, kinect_thread, k))
+  {
+    delete k;
+    riftwm_error(wm,"Couldnt start kinect thread");
+  }
+
   return k;
 }
 
+void
+kinect_calibration(kinect_t *k, float shift[3])
+{
+  shift[0] = k->x_shift;
+  shift[1] = k->y_shift;
+  shift[2] = k->z_shift;
+}
+
+void
+kinect_calibrate(kinect_t *k, float shift[3])
+{
+  k->x_shift = shift[0];
+  k->y_shift = shift[1];
+  k->z_shift = shift[2];
+}
+
 void
 kinect_update(kinect_t *k)
 {
   nite::UserTrackerFrameRef frame;
+
+  if (k->ready <= 0) {
+    if (k->ready < 0) {
+      riftwm_error(k->wm, "%s", k->error);
+    }
+    return;
+  }
+  __sync_synchronize();
+
   k->tracker->readFrame(&frame);
+  if (frame.isValid()) {
+    k->depth = frame.getDepthFrame();
+  }
   const nite::Array<nite::UserData>& users = frame.getUsers();
   if (!users.isEmpty())
   {
@@ -143,13 +213,12 @@ kinect_update(kinect_t *k)
           }
 
 
-          // Update the head position
-          hx = head_point.x, hy = head_point.y, hz = head_point.z;
-          smooth_add(&k->s_pos, head_point.x, head_point.y, head_point.z);
-          smooth_get(&k->s_pos, &hx, &hy, &hz);
-          k->r->pos[0] = (k->x_shift - hx) / 200.0f - k->r->origin[0];
-          k->r->pos[1] = (k->y_shift - hy) / 200.0f - k->r->origin[1];
-          k->r->pos[2] = (k->z_shift - hz) / 200.0f - k->r->origin[2];
+          // The head position is filtered in kinect_step
+          k->head[0] = head_point.x;
+          k->head[1] = head_point.y;
+          k->head[2] = head_point.z;
+          k->tracked = true;
+          trace_emit(&k->wm->trace, TRACE_MAIN, TRACE_HEAD, 0, k->head);
 
           // Left hand
           hx = left_hand_point.x, hy = left_hand_point.y, hz = left_hand_point.z;
@@ -162,8 +231,6 @@ kinect_update(kinect_t *k)
           k->r->rightHand[0] = (k->x_shift - hx) / 200.0f - k->r->origin[0];
           k->r->rightHand[1] = (k->y_shift - hy) / 200.0f - k->r->origin[1];
           k->r->rightHand[2] = (k->z_shift - hz) / 200.0f - k->r->origin[2];
-
-          fprintf(stderr, "%f %f %f\n", k->r->pos[0], k->r->pos[1], k->r->pos[2]);
         }
       }
 
@@ -175,9 +242,41 @@ kinect_update(kinect_t *k)
   }
 }
 
+void
+kinect_step(kinect_t *k, float pos[3])
+{
+  float hx, hy, hz;
+
+  if (!k->tracked) {
+    return;
+  }
+
+  // One sample per step, so the average spans a fixed time
+  smooth_add(&k->s_pos, k->head[0], k->head[1], k->head[2]);
+  smooth_get(&k->s_pos, &hx, &hy, &hz);
+  pos[0] = (k->x_shift - hx) / 200.0f - k->r->origin[0];
+  pos[1] = (k->y_shift - hy) / 200.0f - k->r->origin[1];
+  pos[2] = (k->z_shift - hz) / 200.0f - k->r->origin[2];
+}
+
+const uint16_t *
+kinect_depth(kinect_t *k, int *width, int *height, unsigned *serial)
+{
+  if (!k->depth.isValid()) {
+    return NULL;
+  }
+
+  *width = k->depth.getWidth();
+  *height = k->depth.getHeight();
+  *serial = k->depth.getFrameIndex();
+  return (const uint16_t*)k->depth.getData();
+}
+
 void
 kinect_destroy(kinect_t *k)
 {
+  k->depth.release();
+  pthread_join(k->thread, NULL);
   delete k->tracker;
   delete k;
 }
@@ -4,6 +4,8 @@
 #ifndef __KINECT_H__
 #define __KINECT_H__
 
+#include <stdint.h>
+
 typedef struct kinect_t kinect_t;
 
 #ifdef __cplusplus
@@ -12,6 +14,11 @@ extern "C"
 #endif
 	kinect_t *kinect_init(riftwm_t *);
 	void kinect_update(kinect_t *);
+	void kinect_step(kinect_t *, float pos[3]);
+	void kinect_calibration(kinect_t *, float shift[3]);
+	void kinect_calibrate(kinect_t *, float shift[3]);
+	const uint16_t *kinect_depth(kinect_t *, int *width, int *height,
+	                             unsigned *serial);
 	void kinect_destroy(kinect_t *);
 #ifdef __cplusplus
 }
@@ -0,0 +1,543 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "riftwm.h"
+#include "layout.h"
+
+// Cells in one ring
+#define LAYOUT_RING (LAYOUT_COLUMNS * LAYOUT_ROWS)
+
+// Bounding box of the window quad in model space
+static const aabb_t UNIT_QUAD = { { -1.0f, -1.0f, 0.0f }, { 1.0f, 1.0f, 0.0f } };
+
+// -----------------------------------------------------------------------------
+// Cells
+// -----------------------------------------------------------------------------
+static void
+cell_coords(int cell, int *ring, int *col, int *row)
+{
+  int k = cell % LAYOUT_RING, rank;
+
+  // Columns alternate left and right of the front, rows above and below
+  *ring = cell / LAYOUT_RING;
+  rank = k / LAYOUT_ROWS;
+  *col = (rank + 1) / 2 * ((rank & 1) ? -1 : 1);
+  rank = k % LAYOUT_ROWS;
+  *row = (rank + 1) / 2 * ((rank & 1) ? 1 : -1);
+}
+
+static float
+cell_radius(int ring)
+{
+  return LAYOUT_RADIUS + ring * LAYOUT_RING_STEP;
+}
+
+static void
+ring_pose(layout_t *l, float radius, int col, int row, vec3 pos, vec3 rot)
+{
+  float az, el;
+
+  az = col * 2.0f * M_PI / LAYOUT_COLUMNS;
+
+  // Windows face the centre: yaw by the azimuth, pitch by the elevation
+  switch (l->shape) {
+    case LAYOUT_CYLINDER:
+    {
+      el = 0.0f;
+      pos[0] = l->center[0] + radius * sinf(az);
+      pos[1] = l->center[1] + row * LAYOUT_ROW_HEIGHT;
+      pos[2] = l->center[2] - radius * cosf(az);
+      break;
+    }
+    case LAYOUT_SPHERE:
+    {
+      el = row * LAYOUT_ROW_ANGLE;
+      pos[0] = l->center[0] + radius * cosf(el) * sinf(az);
+      pos[1] = l->center[1] + radius * sinf(el);
+      pos[2] = l->center[2] - radius * cosf(el) * cosf(az);
+      break;
+    }
+  }
+
+  rot[0] = el;
+  rot[1] = az;
+  rot[2] = 0.0f;
+}
+
+static void
+cell_pose(layout_t *l, int cell, vec3 pos, vec3 rot)
+{
+  int ring, col, row;
+
+  cell_coords(cell, &ring, &col, &row);
+  ring_pose(l, cell_radius(ring), col, row, pos, rot);
+}
+
+static void
+fit_size(layout_t *l, riftwin_t *win)
+{
+  int ring, col, row;
+  float radius, cw, ch, w, h, s;
+
+  cell_coords(win->cell, &ring, &col, &row);
+  radius = cell_radius(ring);
+  cw = 2.0f * radius * sinf(M_PI / LAYOUT_COLUMNS) * LAYOUT_MARGIN;
+  ch = l->shape == LAYOUT_CYLINDER
+     ? LAYOUT_ROW_HEIGHT * LAYOUT_MARGIN
+     : 2.0f * radius * sinf(LAYOUT_ROW_ANGLE * 0.5f) * LAYOUT_MARGIN;
+
+  // Keep the pixel density of small windows, shrink large ones to fit
+  w = (win->width > 0 ? win->width : 1) * LAYOUT_PIXEL_SIZE;
+  h = (win->height > 0 ? win->height : 1) * LAYOUT_PIXEL_SIZE;
+  s = 1.0f;
+  s = cw / w < s ? cw / w : s;
+  s = ch / h < s ? ch / h : s;
+
+  win->r_width = w * s * 0.5f;
+  win->r_height = h * s * 0.5f;
+}
+
+static void
+win_model(riftwin_t *win, mat4x4 M)
+{
+  mat4x4 T, A, B;
+
+  // T * Ry * Rx * S applied to the unit quad
+  mat4x4_translate(T, win->pos[0], win->pos[1], win->pos[2]);
+  mat4x4_rotate_Y(A, T, win->rot[1]);
+  mat4x4_rotate_X(B, A, win->rot[0]);
+  mat4x4_scale_aniso(B, B, win->r_width, win->r_height, 1.0f);
+  mat4x4_dup(M, B);
+}
+
+static void
+win_transform(riftwin_t *win)
+{
+  aabb_t unit = UNIT_QUAD;
+
+  win_model(win, win->model);
+  aabb_transform_batch(&win->bounds, &win->model, &unit, 1);
+}
+
+// -----------------------------------------------------------------------------
+// Free cells
+// -----------------------------------------------------------------------------
+static void
+heap_swap(layout_t *l, int i, int j)
+{
+  int tmp = l->free[i];
+  l->free[i] = l->free[j];
+  l->free[j] = tmp;
+}
+
+static void
+heap_up(layout_t *l, int i)
+{
+  while (i > 0 && l->free[(i - 1) >> 1] > l->free[i]) {
+    heap_swap(l, i, (i - 1) >> 1);
+    i = (i - 1) >> 1;
+  }
+}
+
+static void
+heap_down(layout_t *l, int i)
+{
+  int c;
+
+  while ((c = (i << 1) + 1) < l->free_count) {
+    if (c + 1 < l->free_count && l->free[c + 1] < l->free[c]) {
+      ++c;
+    }
+    if (l->free[i] <= l->free[c]) {
+      break;
+    }
+    heap_swap(l, i, c);
+    i = c;
+  }
+}
+
+static void
+heap_push(layout_t *l, int cell)
+{
+  if (l->free_count >= l->free_cap) {
+    l->free_cap = l->free_cap ? (l->free_cap << 1) : LAYOUT_RING;
+    assert((l->free = (int*)realloc(l->free, sizeof(int) * l->free_cap)));
+  }
+
+  l->free[l->free_count] = cell;
+  heap_up(l, l->free_count++);
+}
+
+static int
+heap_pop(layout_t *l)
+{
+  int cell = l->free[0];
+
+  l->free[0] = l->free[--l->free_count];
+  heap_down(l, 0);
+  return cell;
+}
+
+static int
+heap_remove(layout_t *l, int cell)
+{
+  int i;
+
+  for (i = 0; i < l->free_count; ++i) {
+    if (l->free[i] == cell) {
+      l->free[i] = l->free[--l->free_count];
+      if (i < l->free_count) {
+        heap_up(l, i);
+        heap_down(l, i);
+      }
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void
+add_ring(layout_t *l)
+{
+  int i, n = l->cell_count;
+
+  l->cell_count += LAYOUT_RING;
+  assert((l->cells = (riftwin_t**)realloc(l->cells,
+                     sizeof(riftwin_t*) * l->cell_count)));
+  for (i = n; i < l->cell_count; ++i) {
+    l->cells[i] = NULL;
+    heap_push(l, i);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Animations
+// -----------------------------------------------------------------------------
+static void
+anim_start(layout_t *l, riftwin_t *win)
+{
+  layout_anim_t *a;
+
+  if (win->anim < 0) {
+    if (l->anim_count >= l->anim_cap) {
+      l->anim_cap = l->anim_cap ? (l->anim_cap << 1) : 16;
+      assert((l->anims = (layout_anim_t*)realloc(l->anims,
+                         sizeof(layout_anim_t) * l->anim_cap)));
+      assert((l->models = (mat4x4*)realloc(l->models,
+                          sizeof(mat4x4) * l->anim_cap)));
+      assert((l->bounds = (aabb_t*)realloc(l->bounds,
+                          sizeof(aabb_t) * l->anim_cap)));
+    }
+    win->anim = l->anim_count++;
+  }
+
+  // A window already on its way starts over from where it is now
+  a = &l->anims[win->anim];
+  a->win = win;
+  a->t = 0.0f;
+  memcpy(a->from_pos, win->pos, sizeof(vec3));
+  memcpy(a->from_rot, win->rot, sizeof(vec3));
+}
+
+static void
+anim_stop(layout_t *l, riftwin_t *win)
+{
+  int i = win->anim;
+
+  l->anims[i] = l->anims[--l->anim_count];
+  l->anims[i].win->anim = i;
+  win->anim = -1;
+}
+
+static void
+move_to_cell(layout_t *l, riftwin_t *win, int animate)
+{
+  if (animate) {
+    anim_start(l, win);
+    return;
+  }
+
+  if (win->anim >= 0) {
+    anim_stop(l, win);
+  }
+  cell_pose(l, win->cell, win->pos, win->rot);
+  win_transform(win);
+}
+
+// -----------------------------------------------------------------------------
+// Attached windows
+// -----------------------------------------------------------------------------
+static void
+attached_pose(layout_t *l, riftwin_t *win)
+{
+  riftwin_t *p = win->parent;
+  float pw, ph, dx, dy;
+  vec4 local, world;
+
+  // Docks keep their pixel size, one row below the front cell
+  if (win->attach == LAYOUT_ATTACH_DOCK) {
+    ring_pose(l, cell_radius(0), 0, -1, win->pos, win->rot);
+    win->r_width = (win->width > 0 ? win->width : 1) * LAYOUT_PIXEL_SIZE * 0.5f;
+    win->r_height = (win->height > 0 ? win->height : 1) * LAYOUT_PIXEL_SIZE *
+                    0.5f;
+    win_transform(win);
+    return;
+  }
+
+  // Orphans stay where their parent left them
+  if (!p) {
+    return;
+  }
+
+  // Same pixel density as the parent. Menus keep their offset from it on
+  // screen, dialogs are centred on it.
+  pw = p->width > 0 ? p->width : 1;
+  ph = p->height > 0 ? p->height : 1;
+  win->r_width = p->r_width * (win->width > 0 ? win->width : 1) / pw;
+  win->r_height = p->r_height * (win->height > 0 ? win->height : 1) / ph;
+  dx = dy = 0.0f;
+  if (win->attach == LAYOUT_ATTACH_OFFSET) {
+    dx = (win->x + win->width * 0.5f) - (p->x + pw * 0.5f);
+    dy = (win->y + win->height * 0.5f) - (p->y + ph * 0.5f);
+  }
+
+  // The parent model maps its quad to [-1, 1] and leaves z unscaled
+  local[0] = dx * 2.0f / pw;
+  local[1] = -dy * 2.0f / ph;
+  local[2] = LAYOUT_ATTACH_DEPTH;
+  local[3] = 1.0f;
+  mat4x4_mul_vec4(world, p->model, local);
+  memcpy(win->pos, world, sizeof(vec3));
+  memcpy(win->rot, p->rot, sizeof(vec3));
+  win_transform(win);
+}
+
+static void
+pose_attached(layout_t *l)
+{
+  int i;
+
+  for (i = 0; i < l->attached_count; ++i) {
+    attached_pose(l, l->attached[i]);
+  }
+}
+
+static void
+detach(layout_t *l, riftwin_t *win)
+{
+  int i, j;
+
+  for (i = 0, j = 0; i < l->attached_count; ++i) {
+    if (l->attached[i] != win) {
+      l->attached[j++] = l->attached[i];
+    }
+  }
+  l->attached_count = j;
+  win->attach = LAYOUT_ATTACH_NONE;
+  win->parent = NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+void
+layout_init(layout_t *l, layout_shape_t shape, vec3 center)
+{
+  memset(l, 0, sizeof(layout_t));
+  l->shape = shape;
+  memcpy(l->center, center, sizeof(vec3));
+  add_ring(l);
+}
+
+void
+layout_place(layout_t *l, riftwin_t *win, int animate)
+{
+  vec3 dir;
+
+  if (win->cell >= 0 && win->cell < l->cell_count &&
+      l->cells[win->cell] == win)
+  {
+    layout_resize(l, win);
+    return;
+  }
+
+  // A cell may be requested, e.g. to keep the placement across a restart
+  if (win->cell >= 0) {
+    while (win->cell >= l->cell_count) {
+      add_ring(l);
+    }
+    if (!heap_remove(l, win->cell)) {
+      win->cell = -1;
+    }
+  }
+
+  if (win->cell < 0) {
+    if (!l->free_count) {
+      add_ring(l);
+    }
+    win->cell = heap_pop(l);
+  }
+
+  l->cells[win->cell] = win;
+  fit_size(l, win);
+
+  // New windows fly in from behind their cell
+  if (animate && win->anim < 0) {
+    cell_pose(l, win->cell, win->pos, win->rot);
+    vec3_sub(dir, win->pos, l->center);
+    vec3_norm(dir, dir);
+    vec3_scale(dir, dir, LAYOUT_RING_STEP);
+    vec3_add(win->pos, win->pos, dir);
+    win_transform(win);
+  }
+
+  move_to_cell(l, win, animate);
+}
+
+void
+layout_attach(layout_t *l, riftwin_t *win, riftwin_t *parent,
+              layout_attach_t attach)
+{
+  if (win->attach == LAYOUT_ATTACH_NONE) {
+    if (l->attached_count >= l->attached_cap) {
+      l->attached_cap = l->attached_cap ? (l->attached_cap << 1) : 16;
+      assert((l->attached = (riftwin_t**)realloc(l->attached,
+                            sizeof(riftwin_t*) * l->attached_cap)));
+    }
+    l->attached[l->attached_count++] = win;
+  }
+
+  win->attach = attach;
+  win->parent = parent;
+  attached_pose(l, win);
+}
+
+void
+layout_remove(layout_t *l, riftwin_t *win)
+{
+  riftwin_t *other;
+  int cell, last, i;
+
+  if (win->anim >= 0) {
+    anim_stop(l, win);
+  }
+
+  // Children stay where they are
+  for (i = 0; i < l->attached_count; ++i) {
+    if (l->attached[i]->parent == win) {
+      l->attached[i]->parent = NULL;
+    }
+  }
+  if (win->attach != LAYOUT_ATTACH_NONE) {
+    detach(l, win);
+    return;
+  }
+
+  if (win->cell < 0 || win->cell >= l->cell_count ||
+      l->cells[win->cell] != win)
+  {
+    win->cell = -1;
+    return;
+  }
+
+  cell = win->cell;
+  l->cells[cell] = NULL;
+  win->cell = -1;
+
+  // Pull the farthest window forward into the hole, so the front stays full
+  for (last = l->cell_count - 1; last > cell && !l->cells[last]; --last);
+  if (last > cell) {
+    other = l->cells[last];
+    l->cells[last] = NULL;
+    heap_push(l, last);
+
+    l->cells[cell] = other;
+    other->cell = cell;
+    fit_size(l, other);
+    move_to_cell(l, other, 1);
+  } else {
+    heap_push(l, cell);
+  }
+}
+
+void
+layout_resize(layout_t *l, riftwin_t *win)
+{
+  if (win->cell >= 0) {
+    // Moving windows pick up the new size on the next step
+    fit_size(l, win);
+    if (win->anim < 0) {
+      win_transform(win);
+    }
+  } else if (win->attach == LAYOUT_ATTACH_NONE) {
+    return;
+  }
+
+  pose_attached(l);
+}
+
+int
+layout_animate(layout_t *l, float dt)
+{
+  layout_anim_t *a;
+  riftwin_t *win;
+  vec3 pos, rot;
+  float s, d;
+  int i, j, count = l->anim_count;
+
+  if (!count) {
+    return 0;
+  }
+
+  for (i = 0; i < count; ++i) {
+    a = &l->anims[i];
+    win = a->win;
+    a->t = a->t + dt / LAYOUT_ANIM_TIME;
+    a->t = a->t > 1.0f ? 1.0f : a->t;
+    s = a->t * a->t * (3.0f - 2.0f * a->t);
+
+    // Interpolate the pose, turning the short way around
+    cell_pose(l, win->cell, pos, rot);
+    for (j = 0; j < 3; ++j) {
+      win->pos[j] = a->from_pos[j] + (pos[j] - a->from_pos[j]) * s;
+      d = remainderf(rot[j] - a->from_rot[j], 2.0f * M_PI);
+      win->rot[j] = a->from_rot[j] + d * s;
+    }
+
+    win_model(win, l->models[i]);
+    l->bounds[i] = UNIT_QUAD;
+  }
+
+  aabb_transform_batch(l->bounds, l->models, l->bounds, count);
+
+  for (i = count - 1; i >= 0; --i) {
+    a = &l->anims[i];
+    win = a->win;
+    mat4x4_dup(win->model, l->models[i]);
+    win->bounds = l->bounds[i];
+    if (a->t >= 1.0f) {
+      anim_stop(l, win);
+    }
+  }
+
+  // Attached windows follow their parents
+  pose_attached(l);
+  return count;
+}
+
+void
+layout_destroy(layout_t *l)
+{
+  free(l->free);
+  free(l->cells);
+  free(l->anims);
+  free(l->models);
+  free(l->bounds);
+  free(l->attached);
+  memset(l, 0, sizeof(layout_t));
+}
@@ -0,0 +1,105 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __LAYOUT_H__
+#define __LAYOUT_H__
+
+#include "linmath.h"
+#include "linmath_batch.h"
+
+// Distance of the first ring of cells from the user
+#define LAYOUT_RADIUS 8.0f
+// Extra distance of each further ring, used once the previous one is full
+#define LAYOUT_RING_STEP 4.0f
+// Cells around the user and above each other in a ring
+#define LAYOUT_COLUMNS 8
+#define LAYOUT_ROWS 2
+// Distance between rows on a cylinder, in world units
+#define LAYOUT_ROW_HEIGHT 4.0f
+// Elevation between rows on a sphere, in radians
+#define LAYOUT_ROW_ANGLE 0.45f
+// Fraction of a cell a window may cover
+#define LAYOUT_MARGIN 0.9f
+// World units per window pixel, before windows are fitted into their cell
+#define LAYOUT_PIXEL_SIZE 0.0045f
+// Duration of a move between two cells, in seconds
+#define LAYOUT_ANIM_TIME 0.3f
+// Distance of attached windows in front of their parent, in world units
+#define LAYOUT_ATTACH_DEPTH 0.25f
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+  LAYOUT_CYLINDER,
+  LAYOUT_SPHERE
+} layout_shape_t;
+
+// Placement of windows that do not take a cell
+typedef enum
+{
+  LAYOUT_ATTACH_NONE,
+  LAYOUT_ATTACH_CENTER,
+  LAYOUT_ATTACH_OFFSET,
+  LAYOUT_ATTACH_DOCK
+} layout_attach_t;
+
+// Window moving from its old pose into its cell
+typedef struct layout_anim_t
+{
+  struct riftwin_t *win;
+  vec3              from_pos;
+  vec3              from_rot;
+  float             t;
+} layout_anim_t;
+
+// Windows are assigned cells on rings around the user. Cells are numbered
+// from straight ahead outwards, so the best free one is the smallest.
+// Mapping, unmapping or resizing a window only touches that window and at
+// most one other which moves forward into the freed cell. Dialogs and
+// menus are attached in front of their parent instead and docks sit below
+// the front cell; they follow their anchor but take no cell.
+typedef struct layout_t
+{
+  layout_shape_t    shape;
+  vec3              center;
+
+  // Free cells of the rings created so far, as a min-heap
+  int              *free;
+  int               free_count;
+  int               free_cap;
+
+  // Owner of each cell
+  struct riftwin_t **cells;
+  int               cell_count;
+
+  // Running animations, with scratch space to batch their transforms
+  layout_anim_t    *anims;
+  mat4x4           *models;
+  aabb_t           *bounds;
+  int               anim_count;
+  int               anim_cap;
+
+  // Windows posed from a parent or docked, parents before their children
+  struct riftwin_t **attached;
+  int               attached_count;
+  int               attached_cap;
+} layout_t;
+
+void layout_init(layout_t *, layout_shape_t, vec3 center);
+void layout_place(layout_t *, struct riftwin_t *, int animate);
+void layout_attach(layout_t *, struct riftwin_t *, struct riftwin_t *parent,
+                   layout_attach_t);
+void layout_remove(layout_t *, struct riftwin_t *);
+void layout_resize(layout_t *, struct riftwin_t *);
+int layout_animate(layout_t *, float dt);
+void layout_destroy(layout_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__LAYOUT_H__*/
@@ -0,0 +1,280 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <string.h>
+#include "linmath_batch.h"
+
+#if defined(__SSE__)
+#  include <xmmintrin.h>
+#  define LINMATH_SSE
+#endif
+
+#if defined(LINMATH_SSE) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define LINMATH_AVX __attribute__((target("avx")))
+#endif
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+#ifdef LINMATH_AVX
+static int
+has_avx(void)
+{
+  static int avx = -1;
+
+  if (avx < 0) {
+    __builtin_cpu_init();
+    avx = __builtin_cpu_supports("avx") ? 1 : 0;
+  }
+
+  return avx;
+}
+#endif
+
+#ifdef LINMATH_SSE
+static inline __m128
+load_vec3(const float *v, float w)
+{
+  return _mm_set_ps(w, v[2], v[1], v[0]);
+}
+
+static inline void
+store_vec3(float *v, __m128 x)
+{
+  float tmp[4];
+
+  _mm_storeu_ps(tmp, x);
+  v[0] = tmp[0];
+  v[1] = tmp[1];
+  v[2] = tmp[2];
+}
+
+static inline __m128
+abs_ps(__m128 x)
+{
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+
+// Columns of a 4x4 matrix times the four components of b
+static inline __m128
+mul_col(__m128 a0, __m128 a1, __m128 a2, __m128 a3, const float *b)
+{
+  __m128 r;
+
+  r = _mm_mul_ps(a0, _mm_set1_ps(b[0]));
+  r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[1])));
+  r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[2])));
+  r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[3])));
+  return r;
+}
+#endif
+
+#ifdef LINMATH_AVX
+// Same as mul_col, for two consecutive columns at once
+LINMATH_AVX static inline __m256
+mul_col2(__m256 a0, __m256 a1, __m256 a2, __m256 a3, const float *b)
+{
+  __m256 x = _mm256_loadu_ps(b), r;
+
+  r = _mm256_mul_ps(a0, _mm256_permute_ps(x, 0x00));
+  r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_permute_ps(x, 0x55)));
+  r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(x, 0xAA)));
+  r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(x, 0xFF)));
+  return r;
+}
+
+LINMATH_AVX static void
+mat4x4_mul_vec4_batch_avx(vec4 *r, mat4x4 M, vec4 *v, int n)
+{
+  __m256 m0 = _mm256_broadcast_ps((const __m128*)M[0]);
+  __m256 m1 = _mm256_broadcast_ps((const __m128*)M[1]);
+  __m256 m2 = _mm256_broadcast_ps((const __m128*)M[2]);
+  __m256 m3 = _mm256_broadcast_ps((const __m128*)M[3]);
+  int i;
+
+  for (i = 0; i + 1 < n; i += 2) {
+    _mm256_storeu_ps(r[i], mul_col2(m0, m1, m2, m3, v[i]));
+  }
+
+  if (i < n) {
+    _mm_storeu_ps(r[i], mul_col(_mm256_castps256_ps128(m0),
+                                _mm256_castps256_ps128(m1),
+                                _mm256_castps256_ps128(m2),
+                                _mm256_castps256_ps128(m3), v[i]));
+  }
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+void
+mat4x4_mul_vec4_batch(vec4 *r, mat4x4 M, vec4 *v, int n)
+{
+#ifdef LINMATH_AVX
+  if (has_avx()) {
+    mat4x4_mul_vec4_batch_avx(r, M, v, n);
+    return;
+  }
+#endif
+
+#ifdef LINMATH_SSE
+  __m128 m0 = _mm_loadu_ps(M[0]);
+  __m128 m1 = _mm_loadu_ps(M[1]);
+  __m128 m2 = _mm_loadu_ps(M[2]);
+  __m128 m3 = _mm_loadu_ps(M[3]);
+  int i;
+
+  for (i = 0; i < n; ++i) {
+    _mm_storeu_ps(r[i], mul_col(m0, m1, m2, m3, v[i]));
+  }
+#else
+  vec4 tmp;
+  int i;
+
+  for (i = 0; i < n; ++i) {
+    mat4x4_mul_vec4(tmp, M, v[i]);
+    memcpy(r[i], tmp, sizeof(vec4));
+  }
+#endif
+}
+
+void
+aabb_transform_batch(aabb_t *out, mat4x4 *M, aabb_t *in, int n)
+{
+#ifdef LINMATH_SSE
+  const __m128 HALF = _mm_set1_ps(0.5f);
+  __m128 lo, hi, c, e, m0, m1, m2, rc, re;
+  float cf[4], ef[4];
+  int i;
+
+  // Transform the centre, and the extent by the absolute matrix
+  for (i = 0; i < n; ++i) {
+    lo = load_vec3(in[i].min, 0.0f);
+    hi = load_vec3(in[i].max, 0.0f);
+    c = _mm_mul_ps(_mm_add_ps(lo, hi), HALF);
+    e = _mm_mul_ps(_mm_sub_ps(hi, lo), HALF);
+    _mm_storeu_ps(cf, c);
+    _mm_storeu_ps(ef, e);
+
+    m0 = _mm_loadu_ps(M[i][0]);
+    m1 = _mm_loadu_ps(M[i][1]);
+    m2 = _mm_loadu_ps(M[i][2]);
+
+    rc = _mm_loadu_ps(M[i][3]);
+    rc = _mm_add_ps(rc, _mm_mul_ps(m0, _mm_set1_ps(cf[0])));
+    rc = _mm_add_ps(rc, _mm_mul_ps(m1, _mm_set1_ps(cf[1])));
+    rc = _mm_add_ps(rc, _mm_mul_ps(m2, _mm_set1_ps(cf[2])));
+
+    re = _mm_mul_ps(abs_ps(m0), _mm_set1_ps(ef[0]));
+    re = _mm_add_ps(re, _mm_mul_ps(abs_ps(m1), _mm_set1_ps(ef[1])));
+    re = _mm_add_ps(re, _mm_mul_ps(abs_ps(m2), _mm_set1_ps(ef[2])));
+
+    store_vec3(out[i].min, _mm_sub_ps(rc, re));
+    store_vec3(out[i].max, _mm_add_ps(rc, re));
+  }
+#else
+  float c[3], e[3], rc, re;
+  int i, j;
+
+  for (i = 0; i < n; ++i) {
+    for (j = 0; j < 3; ++j) {
+      c[j] = (in[i].min[j] + in[i].max[j]) * 0.5f;
+      e[j] = (in[i].max[j] - in[i].min[j]) * 0.5f;
+    }
+
+    for (j = 0; j < 3; ++j) {
+      rc = M[i][3][j] + M[i][0][j] * c[0] + M[i][1][j] * c[1] +
+           M[i][2][j] * c[2];
+      re = fabsf(M[i][0][j]) * e[0] + fabsf(M[i][1][j]) * e[1] +
+           fabsf(M[i][2][j]) * e[2];
+      out[i].min[j] = rc - re;
+      out[i].max[j] = rc + re;
+    }
+  }
+#endif
+}
+
+static int
+aabb_visible(vec4 planes[6], aabb_t *box)
+{
+  float c, e, d;
+  int i, j;
+
+  for (i = 0; i < 6; ++i) {
+    d = planes[i][3];
+    for (j = 0; j < 3; ++j) {
+      c = (box->min[j] + box->max[j]) * 0.5f;
+      e = (box->max[j] - box->min[j]) * 0.5f;
+      d += planes[i][j] * c + fabsf(planes[i][j]) * e;
+    }
+
+    if (d < 0.0f) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+void
+aabb_cull_batch(int *visible, vec4 planes[6], aabb_t *box, int n)
+{
+  int i = 0;
+
+#ifdef LINMATH_SSE
+  const __m128 HALF = _mm_set1_ps(0.5f);
+  __m128 c[3], e[3], d, in;
+  int j, k, mask;
+
+  // Four boxes at a time, one per lane
+  for (; i + 3 < n; i += 4) {
+    for (j = 0; j < 3; ++j) {
+      __m128 lo = _mm_set_ps(box[i + 3].min[j], box[i + 2].min[j],
+                             box[i + 1].min[j], box[i + 0].min[j]);
+      __m128 hi = _mm_set_ps(box[i + 3].max[j], box[i + 2].max[j],
+                             box[i + 1].max[j], box[i + 0].max[j]);
+      c[j] = _mm_mul_ps(_mm_add_ps(lo, hi), HALF);
+      e[j] = _mm_mul_ps(_mm_sub_ps(hi, lo), HALF);
+    }
+
+    in = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+    for (k = 0; k < 6; ++k) {
+      d = _mm_set1_ps(planes[k][3]);
+      for (j = 0; j < 3; ++j) {
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[k][j]), c[j]));
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(fabsf(planes[k][j])), e[j]));
+      }
+      in = _mm_and_ps(in, _mm_cmpge_ps(d, _mm_setzero_ps()));
+    }
+
+    mask = _mm_movemask_ps(in);
+    visible[i + 0] = (mask >> 0) & 1;
+    visible[i + 1] = (mask >> 1) & 1;
+    visible[i + 2] = (mask >> 2) & 1;
+    visible[i + 3] = (mask >> 3) & 1;
+  }
+#endif
+
+  for (; i < n; ++i) {
+    visible[i] = aabb_visible(planes, &box[i]);
+  }
+}
+
+void
+frustum_planes(vec4 planes[6], mat4x4 M)
+{
+  int i;
+
+  // Gribb & Hartmann: combinations of the rows of the matrix
+  for (i = 0; i < 4; ++i) {
+    planes[0][i] = M[i][3] + M[i][0];
+    planes[1][i] = M[i][3] - M[i][0];
+    planes[2][i] = M[i][3] + M[i][1];
+    planes[3][i] = M[i][3] - M[i][1];
+    planes[4][i] = M[i][3] + M[i][2];
+    planes[5][i] = M[i][3] - M[i][2];
+  }
+}
@@ -0,0 +1,37 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __LINMATH_BATCH_H__
+#define __LINMATH_BATCH_H__
+
+#include "linmath.h"
+
+// Batched versions of the linmath.h kernels, for transforming all windows
+// at once. SSE is used when available and AVX is picked at runtime; other
+// targets fall back to the scalar routines. Arrays need not be aligned.
+
+typedef struct aabb_t
+{
+  vec3              min;
+  vec3              max;
+} aabb_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// r[i] = M * v[i]
+void mat4x4_mul_vec4_batch(vec4 *r, mat4x4 M, vec4 *v, int n);
+// out[i] = bounding box of M[i] applied to in[i], M[i] affine
+void aabb_transform_batch(aabb_t *out, mat4x4 *M, aabb_t *in, int n);
+// visible[i] = whether box[i] is on the positive side of all six planes
+void aabb_cull_batch(int *visible, vec4 planes[6], aabb_t *box, int n);
+// Extracts the frustum planes of a projection * view matrix
+void frustum_planes(vec4 planes[6], mat4x4 M);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__LINMATH_BATCH_H__*/
@@ -0,0 +1,182 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "passthrough.h"
+#include "shader/points.vs.glsl.h"
+#include "shader/points.fs.glsl.h"
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+void
+passthrough_init(passthrough_t *p, shaders_t *shaders)
+{
+  const GLbitfield FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                           GL_MAP_COHERENT_BIT;
+  const int count = PASSTHROUGH_WIDTH * PASSTHROUGH_HEIGHT;
+  float *pixels;
+  size_t size;
+  int i;
+
+  memset(p, 0, sizeof(passthrough_t));
+  p->region = -1;
+  p->region_size = count * sizeof(uint16_t);
+  pthread_mutex_init(&p->lock, NULL);
+
+  // Pixel coordinates never change, only the depth is streamed
+  assert((pixels = (float*)malloc(sizeof(float) * 2 * count)));
+  for (i = 0; i < count; ++i) {
+    pixels[i * 2 + 0] = (i % PASSTHROUGH_WIDTH + 0.5f) / PASSTHROUGH_WIDTH;
+    pixels[i * 2 + 1] = (i / PASSTHROUGH_WIDTH + 0.5f) / PASSTHROUGH_HEIGHT;
+  }
+  glGenBuffers(1, &p->pixels);
+  glBindBuffer(GL_ARRAY_BUFFER, p->pixels);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * count, pixels,
+               GL_STATIC_DRAW);
+  free(pixels);
+
+  size = p->region_size * PASSTHROUGH_REGIONS;
+  glGenBuffers(1, &p->depth);
+  glBindBuffer(GL_ARRAY_BUFFER, p->depth);
+  if (GLEW_ARB_buffer_storage) {
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, FLAGS);
+    p->mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, FLAGS);
+  } else {
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  shader_init(shaders, &p->shader,
+              SHADER_DIR "/points.vs.glsl", shader_points_vs_glsl,
+              shader_points_vs_glsl_len,
+              SHADER_DIR "/points.fs.glsl", shader_points_fs_glsl,
+              shader_points_fs_glsl_len);
+  passthrough_locate(p);
+}
+
+void
+passthrough_locate(passthrough_t *p)
+{
+  p->a_pixel = glGetAttribLocation(p->shader.prog, "a_pixel");
+  p->a_depth = glGetAttribLocation(p->shader.prog, "a_depth");
+  p->u_fov_scale = glGetUniformLocation(p->shader.prog, "u_fov_scale");
+  p->u_shift = glGetUniformLocation(p->shader.prog, "u_shift");
+  p->u_origin = glGetUniformLocation(p->shader.prog, "u_origin");
+}
+
+void
+passthrough_upload(passthrough_t *p, const uint16_t *depth)
+{
+  GLenum status = GL_ALREADY_SIGNALED;
+  int next;
+
+  // Skip the frame rather than wait for the renderer to let go. A region
+  // named by the snapshot being drawn or the one after it has no fence
+  // yet, or only the fence of an older draw. Both are polled under the
+  // lock since the render thread replaces them.
+  next = (p->region + 1) % PASSTHROUGH_REGIONS;
+  pthread_mutex_lock(&p->lock);
+  if (p->serials[next] && p->serials[next] >= p->released) {
+    status = GL_TIMEOUT_EXPIRED;
+  } else if (p->fences[next]) {
+    status = glClientWaitSync(p->fences[next], 0, 0);
+  }
+  pthread_mutex_unlock(&p->lock);
+  if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+    p->dropped++;
+    return;
+  }
+
+  if (p->mapped) {
+    memcpy((char*)p->mapped + next * p->region_size, depth, p->region_size);
+  } else {
+    glBindBuffer(GL_ARRAY_BUFFER, p->depth);
+    glBufferSubData(GL_ARRAY_BUFFER, next * p->region_size, p->region_size,
+                    depth);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+  p->region = next;
+}
+
+void
+passthrough_reference(passthrough_t *p, int region, unsigned serial)
+{
+  pthread_mutex_lock(&p->lock);
+  p->serials[region] = serial;
+  pthread_mutex_unlock(&p->lock);
+}
+
+void
+passthrough_release(passthrough_t *p, unsigned serial)
+{
+  // Snapshots older than the one now drawn are done with their region
+  pthread_mutex_lock(&p->lock);
+  p->released = serial;
+  pthread_mutex_unlock(&p->lock);
+}
+
+void
+passthrough_draw(passthrough_t *p, int region, const float shift[3],
+                 const float origin[3])
+{
+  GLsync fence;
+
+  if (region < 0 || !p->shader.prog) {
+    return;
+  }
+
+  glUseProgram(p->shader.prog);
+  glUniform2f(p->u_fov_scale, 2.0f * tanf(PASSTHROUGH_HFOV * 0.5f),
+              2.0f * tanf(PASSTHROUGH_VFOV * 0.5f));
+  glUniform3fv(p->u_shift, 1, shift);
+  glUniform3fv(p->u_origin, 1, origin);
+
+  glBindBuffer(GL_ARRAY_BUFFER, p->pixels);
+  glEnableVertexAttribArray(p->a_pixel);
+  glVertexAttribPointer(p->a_pixel, 2, GL_FLOAT, GL_FALSE, 0, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, p->depth);
+  glEnableVertexAttribArray(p->a_depth);
+  glVertexAttribPointer(p->a_depth, 1, GL_UNSIGNED_SHORT, GL_FALSE, 0,
+                        (const void*)(region * p->region_size));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glDisable(GL_TEXTURE_2D);
+  glPointSize(2.0f);
+  glDrawArrays(GL_POINTS, 0, PASSTHROUGH_WIDTH * PASSTHROUGH_HEIGHT);
+  glEnable(GL_TEXTURE_2D);
+
+  glDisableVertexAttribArray(p->a_pixel);
+  glDisableVertexAttribArray(p->a_depth);
+  glUseProgram(0);
+
+  // The main thread may write the region again once this has passed
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  pthread_mutex_lock(&p->lock);
+  if (p->fences[region]) {
+    glDeleteSync(p->fences[region]);
+  }
+  p->fences[region] = fence;
+  pthread_mutex_unlock(&p->lock);
+}
+
+void
+passthrough_destroy(passthrough_t *p)
+{
+  int i;
+
+  for (i = 0; i < PASSTHROUGH_REGIONS; ++i) {
+    if (p->fences[i]) {
+      glDeleteSync(p->fences[i]);
+    }
+  }
+  if (p->depth) {
+    glDeleteBuffers(1, &p->depth);
+    glDeleteBuffers(1, &p->pixels);
+    pthread_mutex_destroy(&p->lock);
+  }
+  memset(p, 0, sizeof(passthrough_t));
+}
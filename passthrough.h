@@ -0,0 +1,65 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __PASSTHROUGH_H__
+#define __PASSTHROUGH_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <GL/glew.h>
+#include "shader.h"
+
+// Resolution of the depth stream
+#define PASSTHROUGH_WIDTH 640
+#define PASSTHROUGH_HEIGHT 480
+// Depth frames in the buffer: one written, the others being drawn
+#define PASSTHROUGH_REGIONS 3
+// Fields of view of the depth camera, in radians
+#define PASSTHROUGH_HFOV 1.0144f
+#define PASSTHROUGH_VFOV 0.7898f
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Kinect depth shown as a point cloud. The main thread copies each depth
+// frame into a region of a persistently mapped buffer; the render thread
+// draws it as points, unprojected in the vertex shader. A region is only
+// written again once no snapshot still to be drawn names it and the fence
+// placed after its last draw has passed.
+typedef struct passthrough_t
+{
+  GLuint            depth;
+  GLuint            pixels;
+  void             *mapped;
+  size_t            region_size;
+  int               region;
+  GLsync            fences[PASSTHROUGH_REGIONS];
+  unsigned          serials[PASSTHROUGH_REGIONS];
+  unsigned          released;
+  pthread_mutex_t   lock;
+  unsigned          dropped;
+
+  shader_t          shader;
+  GLint             a_pixel;
+  GLint             a_depth;
+  GLint             u_fov_scale;
+  GLint             u_shift;
+  GLint             u_origin;
+} passthrough_t;
+
+void passthrough_init(passthrough_t *, shaders_t *);
+void passthrough_locate(passthrough_t *);
+void passthrough_upload(passthrough_t *, const uint16_t *depth);
+void passthrough_reference(passthrough_t *, int region, unsigned serial);
+void passthrough_release(passthrough_t *, unsigned serial);
+void passthrough_draw(passthrough_t *, int region, const float shift[3],
+                      const float origin[3]);
+void passthrough_destroy(passthrough_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__PASSTHROUGH_H__*/
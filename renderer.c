@@ -9,10 +9,18 @@
 #include <IL/il.h>
 #include "riftwm.h"
 #include "renderer.h"
+#include "handoff.h"
+#include "kinect.h"
+#include "shader/warp.vs.glsl.h"
+#include "shader/warp.fs.glsl.h"
 
 static void
 texture_load(renderer_t *r, GLuint *tex, const char *src)
 {
+  handoff_tex_t *ht;
+  texture_t *t;
+  int width, height;
+
   glGenTextures(1, tex);
   glBindTexture(GL_TEXTURE_2D, *tex);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -20,28 +28,52 @@ texture_load(renderer_t *r, GLuint *tex, const char *src)
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-  int image;
-  ilGenImages(1, &image);
-  ilBindImage(image);
-  if (!ilLoadImage(src)) {
-    riftwm_error(r->wm, "Cannot load texture %s\n", src);
+  // After a restart the decoded image is handed over by the old process
+  if ((ht = handoff_find_texture(r->wm->handoff, src))) {
+    width = ht->width;
+    height = ht->height;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, ht->data);
+  } else {
+    int image;
+    ilGenImages(1, &image);
+    ilBindImage(image);
+    if (!ilLoadImage(src)) {
+      riftwm_error(r->wm, "Cannot load texture %s\n", src);
+    }
+    ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
+    width = ilGetInteger(IL_IMAGE_WIDTH);
+    height = ilGetInteger(IL_IMAGE_HEIGHT);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, ilGetData());
+    ilDeleteImages(1, &image);
   }
-  ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ilGetInteger(IL_IMAGE_WIDTH),
-               ilGetInteger(IL_IMAGE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE,
-               ilGetData());
   glGenerateMipmap(GL_TEXTURE_2D);
+
+  assert(r->texture_count < RENDERER_TEXTURES);
+  t = &r->textures[r->texture_count++];
+  t->tex = *tex;
+  t->src = src;
+  t->width = width;
+  t->height = height;
 }
 
 static void
 fbo_init(renderer_t *r, fbo_t * fbo, int width, int height)
 {
+  // The warp mesh samples outside the eye near the edges: the black border
+  // takes care of those pixels without a test in the shader
+  const GLfloat BORDER[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+  fbo->width = width;
+  fbo->height = height;
   glGenTextures(1, &fbo->color);
   glBindTexture(GL_TEXTURE_2D, fbo->color);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+  glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, BORDER);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
                GL_UNSIGNED_BYTE, 0);
 
@@ -79,64 +111,40 @@ fbo_init(renderer_t *r, fbo_t * fbo, int width, int height)
   }
 }
 
-static GLint
-shader_compile(renderer_t * r, const char *src, GLenum type)
+static void
+fbo_destroy(renderer_t *r, fbo_t *fbo)
 {
-  int status, info_len;
-  char *buffer;
-  long len;
-  FILE *fin;
-
-  if (!(fin = fopen(src, "rb"))) {
-    riftwm_error(r->wm, "Cannot open %s\n", src);
+  if (fbo->fbo) {
+    glDeleteFramebuffers(1, &fbo->fbo);
+    fbo->fbo = 0;
   }
 
-  fseek(fin, 0, SEEK_END);
-  len = ftell(fin);
-  fseek(fin, 0, SEEK_SET);
-
-  buffer = (char*)malloc(len + 1);
-  if (fread(buffer, 1, len, fin) != len) {
-    riftwm_error(r->wm, "Cannot read shader %s\n", src);
+  if (fbo->color) {
+    glDeleteTextures(1, &fbo->color);
+    fbo->color = 0;
   }
-  buffer[len] = '\0';
-  const char *ptr = buffer;
-
-  GLint sh = glCreateShader(type);
-  glShaderSource(sh, 1, &ptr, NULL);
-  glCompileShader(sh);
 
-  glGetShaderiv(sh, GL_COMPILE_STATUS, &status);
-  if (status != GL_TRUE) {
-    glGetShaderiv(sh, GL_INFO_LOG_LENGTH, &info_len);
-    // leak here
-    char *buffer = (char*)malloc(sizeof(char) * info_len);
-    glGetShaderInfoLog(sh, info_len, NULL, buffer);
-    riftwm_error(r->wm, "Shader: %s\n", buffer);
+  if (fbo->depth) {
+    glDeleteTextures(1, &fbo->depth);
+    fbo->depth = 0;
   }
-
-  return sh;
 }
 
 static void
-shader_init(renderer_t *r, shader_t *s, const char *vs, const char *fs)
+warp_locate(renderer_t *r)
 {
-  int status, info_len;
-  GLint prog = glCreateProgram();
-  glAttachShader(prog, shader_compile(r, vs, GL_VERTEX_SHADER));
-  glAttachShader(prog, shader_compile(r, fs, GL_FRAGMENT_SHADER));
-  glLinkProgram(prog);
-
-  glGetProgramiv(prog, GL_LINK_STATUS, &status);
-  if (status != GL_TRUE) {
-    glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &info_len);
-    // leak here
-    char *buffer = (char*)malloc(sizeof(char) * info_len);
-    glGetProgramInfoLog(prog, info_len, NULL, buffer);
-    riftwm_error(r->wm, "Program: %s\n", buffer);
-  }
-
-  s->prog = prog;
+  r->a_pos = glGetAttribLocation(r->warp.prog, "a_pos");
+  r->a_tc_r = glGetAttribLocation(r->warp.prog, "a_tc_r");
+  r->a_tc_g = glGetAttribLocation(r->warp.prog, "a_tc_g");
+  r->a_tc_b = glGetAttribLocation(r->warp.prog, "a_tc_b");
+  r->u_timewarp = glGetUniformLocation(r->warp.prog, "u_timewarp");
+  r->u_layer_count = glGetUniformLocation(r->warp.prog, "u_layer_count");
+  r->u_layer = glGetUniformLocation(r->warp.prog, "u_layer");
+  r->u_layer_tex = glGetUniformLocation(r->warp.prog, "u_layer_tex");
+  r->u_depth = glGetUniformLocation(r->warp.prog, "u_depth");
+  r->u_fovea = glGetUniformLocation(r->warp.prog, "u_fovea");
+  r->u_fovea_center = glGetUniformLocation(r->warp.prog, "u_fovea_center");
+  r->u_inset = glGetUniformLocation(r->warp.prog, "u_inset");
 }
 
 renderer_t *
@@ -148,6 +156,8 @@ renderer_init(riftwm_t *wm)
   memset(r, 0, sizeof(renderer_t));
   r->wm = wm;
   r->aspect = (wm->screen_width / 2.0f) / (float)wm->screen_height;
+  r->eye_width = (int)((wm->screen_width >> 1) * wm->eye_scale);
+  r->eye_height = (int)(wm->screen_height * wm->eye_scale);
   r->rot_x = 0.0f;
   r->rot_y = 0.0f;
 
@@ -162,12 +172,37 @@ renderer_init(riftwm_t *wm)
   r->pos[1] =  0.0f;
   r->pos[2] = -5.0f;
 
-  fbo_init(r, &r->leftFBO, wm->screen_width >> 1, wm->screen_height);
-  fbo_init(r, &r->rightFBO, wm->screen_width >> 1, wm->screen_height);
-  shader_init(r, &r->warp, "shader/warp.vs.glsl", "shader/warp.fs.glsl");
+  quat_identity(r->render_quat);
+  quat_identity(r->head_quat);
+  r->frame_period = 1.0 / RENDERER_REFRESH;
+  r->stats.since = riftwm_time();
+
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->cond, NULL);
+  pthread_cond_init(&r->spectator_cond, NULL);
+  r->back = &r->frames[0];
+  r->ready = &r->frames[1];
+  r->front = &r->frames[2];
 
-  r->u_scr_w = glGetUniformLocation(r->warp.prog, "u_scr_w");
-  r->u_scr_h = glGetUniformLocation(r->warp.prog, "u_scr_h");
+  // Eye framebuffers are not shared: the render thread creates them
+  shaders_init(&r->shaders, wm, wm->shader_reload);
+  shader_init(&r->shaders, &r->warp,
+              SHADER_DIR "/warp.vs.glsl", shader_warp_vs_glsl,
+              shader_warp_vs_glsl_len,
+              SHADER_DIR "/warp.fs.glsl", shader_warp_fs_glsl,
+              shader_warp_fs_glsl_len);
+  warp_locate(r);
+  if (wm->passthrough) {
+    passthrough_init(&r->passthrough, &r->shaders);
+  }
+  if (!wm->no_batch && !batch_init(&r->batch, &r->shaders)) {
+    fprintf(stderr, "Multi-draw unavailable, drawing windows one by one\n");
+  }
+
+  // Precompute the lens distortion for this device and resolution
+  if (!wm->mono) {
+    distort_init(&r->distort, wm, wm->screen_width, wm->screen_height);
+  }
 
   texture_load(r, &r->floor, "textures/floor.jpg");
   texture_load(r, &r->sky_xn, "textures/sky_xn.png");
@@ -180,32 +215,105 @@ renderer_init(riftwm_t *wm)
   return r;
 }
 
+static int
+draw_compare(const void *a, const void *b)
+{
+  const draw_t *da = (const draw_t*)a, *db = (const draw_t*)b;
+
+  // Opaque windows front to back, then translucent ones back to front
+  if (da->translucent != db->translucent) {
+    return da->translucent - db->translucent;
+  }
+  if (da->depth == db->depth) {
+    return 0;
+  }
+  return (da->depth < db->depth) == !da->translucent ? -1 : 1;
+}
+
+static int
+sort_windows(renderer_t *r, frame_t *frame)
+{
+  frame_win_t *win;
+  draw_t *d;
+  mat4x4 view;
+  int i, count = 0;
+
+  if (frame->window_count > r->draw_cap) {
+    r->draw_cap = frame->window_count;
+    assert((r->draws = (draw_t*)realloc(r->draws,
+                       sizeof(draw_t) * r->draw_cap)));
+  }
+
+  // Depth of the window centres along the view axis of this eye
+  glGetFloatv(GL_MODELVIEW_MATRIX, &view[0][0]);
+  for (i = 0; i < frame->window_count; ++i) {
+    if (!frame->visible[i]) {
+      continue;
+    }
+    win = &frame->windows[i];
+    d = &r->draws[count++];
+    d->index = i;
+    d->translucent = win->translucent;
+    d->depth = -(view[0][2] * win->model[3][0] +
+                 view[1][2] * win->model[3][1] +
+                 view[2][2] * win->model[3][2] + view[3][2]);
+  }
+
+  qsort(r->draws, count, sizeof(draw_t), draw_compare);
+  return count;
+}
+
 static void
-render_scene(renderer_t *r)
+draw_window(frame_win_t *win)
 {
-  float depth = 0.0f, mat[16], d;
+  glPushMatrix();
+  glMultMatrixf(&win->model[0][0]);
+  glBindTexture(GL_TEXTURE_2D, win->texture);
+  glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 0.0f); glVertex3f(-1.0f,  1.0f, 0.0f);
+    glTexCoord2f(1.0f, 0.0f); glVertex3f( 1.0f,  1.0f, 0.0f);
+    glTexCoord2f(1.0f, 1.0f); glVertex3f( 1.0f, -1.0f, 0.0f);
+    glTexCoord2f(0.0f, 1.0f); glVertex3f(-1.0f, -1.0f, 0.0f);
+  glEnd();
+  glPopMatrix();
+}
 
-  riftwin_t *win = r->wm->windows;
-  while (win) {
-    riftwin_update(r->wm, win);
-    if (win->mapped) {
-      float height = 2.0f;
-      float width = win->height * height / win->width;
+static void
+draw_windows(renderer_t *r, frame_t *frame, int first, int count)
+{
+  frame_win_t *win;
+  int i;
 
-      glPushMatrix();
-      glBindTexture(GL_TEXTURE_2D, win->texture);
-      glGenerateMipmap(GL_TEXTURE_2D);
-      glBegin(GL_QUADS);
-        glTexCoord2f(0.0f, 0.0f); glVertex3f(-width,  height, 0.0f);
-        glTexCoord2f(1.0f, 0.0f); glVertex3f( width,  height, 0.0f);
-        glTexCoord2f(1.0f, 1.0f); glVertex3f( width, -height, 0.0f);
-        glTexCoord2f(0.0f, 1.0f); glVertex3f(-width, -height, 0.0f);
-      glEnd();
-      glPopMatrix();
+  // Without multi-draw every window costs a bind and a draw
+  for (i = first; i < first + count; ++i) {
+    win = &frame->windows[r->draws[i].index];
+    if (r->batch.supported) {
+      batch_add(&r->batch, win->texture, win->model);
+    } else {
+      draw_window(win);
     }
+  }
+  batch_draw(&r->batch);
+}
+
+static void
+render_scene(renderer_t *r, frame_t *frame)
+{
+  int i, count;
+
+  // Windows are unit quads placed by their model matrix. Opaque ones go
+  // first, nearest first, so that the depth test rejects what they hide.
+  count = sort_windows(r, frame);
+  for (i = 0; i < count && !r->draws[i].translucent; ++i);
+  draw_windows(r, frame, 0, i);
 
-    win = win->next;
-    depth += 3.0f;
+  // Small windows all come from the atlas in a single draw
+  if (frame->atlas_count) {
+    glBindTexture(GL_TEXTURE_2D, frame->atlas);
+    glInterleavedArrays(GL_T2F_V3F, 0, frame->atlas_verts);
+    glDrawArrays(GL_QUADS, 0, frame->atlas_count * 4);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
   }
 
   GLUquadricObj *q = gluNewQuadric();
@@ -213,14 +321,14 @@ render_scene(renderer_t *r)
   glColor3f(1.0f, 0.0f, 0.0f);
 
   glPushMatrix();
-  glTranslatef(-r->leftHand[0], -r->leftHand[1], -r->leftHand[2]);
+  glTranslatef(-frame->leftHand[0], -frame->leftHand[1], -frame->leftHand[2]);
   glDisable(GL_TEXTURE_2D);
   gluSphere(q, 0.1f, 16, 16);
   glEnable(GL_TEXTURE_2D);
   glPopMatrix();
 
   glPushMatrix();
-  glTranslatef(-r->rightHand[0], -r->rightHand[1], -r->rightHand[2]);
+  glTranslatef(-frame->rightHand[0], -frame->rightHand[1], -frame->rightHand[2]);
   glDisable(GL_TEXTURE_2D);
   gluSphere(q, 0.1f, 16, 16);
   glEnable(GL_TEXTURE_2D);
@@ -228,6 +336,10 @@ render_scene(renderer_t *r)
 
   glColor3f(1.0f, 1.0f, 1.0f);
 
+  // Surroundings seen by the kinect
+  passthrough_draw(&r->passthrough, frame->depth_region, frame->depth_shift,
+                   frame->depth_origin);
+
   // Render floor
   glBindTexture(GL_TEXTURE_2D, r->floor);
   glBegin(GL_QUADS);
@@ -273,74 +385,947 @@ render_scene(renderer_t *r)
     glTexCoord2f(1.0f, 1.0f); glVertex3f( 50.0f, -50.0f, -50.0f);
     glTexCoord2f(0.0f, 1.0f); glVertex3f(-50.0f, -50.0f, -50.0f);
   glEnd();
+
+  // ARGB windows last, farthest first, over everything else. Their
+  // contents are premultiplied and must not hide what lies behind them.
+  if (i < count) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+    draw_windows(r, frame, i, count - i);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+  }
 }
 
-void
-renderer_frame(renderer_t *r)
+static float
+layer_priority(frame_t *frame, layer_t *layer)
+{
+  return frame->windows[layer->index].focused ? 0.0f : layer->distance;
+}
+
+static void
+select_layers(renderer_t *r, frame_t *frame)
 {
-  float mat[16];
+  frame_win_t *win;
+  layer_t layer;
+  vec3 d;
+  int i, j;
 
-  // Left eye
-  glBindFramebuffer(GL_FRAMEBUFFER, r->leftFBO.fbo);
+  // The focused window and the nearest opaque others. Translucent windows
+  // need blending and stay in the eye buffers.
+  r->layer_count = 0;
+  for (i = 0; i < frame->window_count; ++i) {
+    win = &frame->windows[i];
+    if (win->translucent) {
+      continue;
+    }
+    d[0] = win->model[3][0] + frame->pos[0];
+    d[1] = win->model[3][1] + frame->pos[1];
+    d[2] = win->model[3][2] + frame->pos[2];
+    layer.index = i;
+    layer.texture = win->texture;
+    layer.distance = vec3_len(d);
+    mat4x4_dup(layer.model, win->model);
+    if (!win->focused && layer.distance > RENDERER_LAYER_DISTANCE) {
+      continue;
+    }
+
+    for (j = r->layer_count; j > 0; --j) {
+      if (layer_priority(frame, &r->layers[j - 1]) <=
+          layer_priority(frame, &layer))
+      {
+        break;
+      }
+      if (j < RENDERER_LAYERS) {
+        r->layers[j] = r->layers[j - 1];
+      }
+    }
+    if (j < RENDERER_LAYERS) {
+      r->layers[j] = layer;
+      if (r->layer_count < RENDERER_LAYERS) {
+        r->layer_count++;
+      }
+    }
+  }
+
+  // Focus only picks the layers, warp_eye composites them by distance
+  for (i = 1; i < r->layer_count; ++i) {
+    layer = r->layers[i];
+    for (j = i; j > 0 && r->layers[j - 1].distance > layer.distance; --j) {
+      r->layers[j] = r->layers[j - 1];
+    }
+    r->layers[j] = layer;
+  }
+}
+
+static void
+keep_layers(renderer_t *r, frame_t *frame)
+{
+  int i, j, k;
+
+  // Reused eye buffers lack the windows that were layers when they were
+  // drawn, so the same layers are composited again. Those whose window
+  // left the snapshot are dropped: their texture may be released.
+  for (i = j = 0; i < r->layer_count; ++i) {
+    for (k = 0; k < frame->window_count; ++k) {
+      if (frame->windows[k].texture == r->layers[i].texture) {
+        r->layers[j++] = r->layers[i];
+        break;
+      }
+    }
+  }
+  r->layer_count = j;
+}
+
+static void
+render_eye(renderer_t *r, frame_t *frame, eye_t eye, fbo_t *fbo, int inset)
+{
+  const float *lc = r->distort.lens_center[eye];
+  mat4x4 proj, view, pv;
+  vec4 planes[6];
+  float mat[16], cx, cy;
+  int i;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo->fbo);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, r->wm->screen_width >> 1, r->wm->screen_height);
+  glViewport(0, 0, fbo->width, fbo->height);
 
+  // Fill the depth buffer where the lens never looks, so the scene is
+  // rejected there before shading. The mesh is in eye texture coordinates.
   glMatrixMode(GL_PROJECTION);
-  ohmd_device_getf(r->wm->rift_dev, OHMD_LEFT_EYE_GL_PROJECTION_MATRIX, mat);
-  glLoadMatrixf(mat);
+  glLoadIdentity();
+  if (inset) {
+    cx = RENDERER_FOVEA_SIZE * 0.5f;
+    glOrtho(lc[0] - cx, lc[0] + cx, lc[1] - cx, lc[1] + cx, 0.0f, 1.0f);
+  } else {
+    glOrtho(0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f);
+  }
+  glMatrixMode(GL_MODELVIEW);
+  glLoadIdentity();
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDisable(GL_TEXTURE_2D);
+  distort_hide(&r->distort, eye);
+  glEnable(GL_TEXTURE_2D);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+  glMatrixMode(GL_PROJECTION);
+  ohmd_device_getf(r->wm->rift_dev, eye == EYE_LEFT ?
+                   OHMD_LEFT_EYE_GL_PROJECTION_MATRIX :
+                   OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX, mat);
+  memcpy(proj, mat, sizeof(mat));
+  if (inset) {
+    // Zoom clip space onto the square around the lens centre
+    cx = lc[0] * 2.0f - 1.0f;
+    cy = lc[1] * 2.0f - 1.0f;
+    for (i = 0; i < 4; ++i) {
+      proj[i][0] = (proj[i][0] - cx * proj[i][3]) / RENDERER_FOVEA_SIZE;
+      proj[i][1] = (proj[i][1] - cy * proj[i][3]) / RENDERER_FOVEA_SIZE;
+    }
+  } else {
+    memcpy(r->proj[eye], mat, sizeof(mat));
+  }
+  glLoadMatrixf(&proj[0][0]);
   glMatrixMode(GL_MODELVIEW);
   glLoadIdentity();
-  ohmd_device_getf(r->wm->rift_dev, OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX, mat);
+  ohmd_device_getf(r->wm->rift_dev, eye == EYE_LEFT ?
+                   OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX :
+                   OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX, mat);
   glLoadMatrixf(mat);
-  glTranslatef(r->pos[0], r->pos[1], r->pos[2]);
-  render_scene(r);
+  glTranslatef(frame->pos[0], frame->pos[1], frame->pos[2]);
+
+  // Skip windows outside the view frustum of this eye
+  memcpy(view, mat, sizeof(mat));
+  mat4x4_translate_in_place(view, frame->pos[0], frame->pos[1], frame->pos[2]);
+  mat4x4_mul(pv, proj, view);
+  frustum_planes(planes, pv);
+  aabb_cull_batch(frame->visible, planes, frame->bounds, frame->window_count);
+  mat4x4_dup(r->view[eye], view);
 
-  // Right eye
-  glBindFramebuffer(GL_FRAMEBUFFER, r->rightFBO.fbo);
+  // Layers are left to the warp pass
+  for (i = 0; i < r->layer_count; ++i) {
+    frame->visible[r->layers[i].index] = 0;
+  }
+
+  render_scene(r, frame);
+}
+
+static void
+render_mono(renderer_t *r, frame_t *frame)
+{
+  mat4x4 proj, rot, view, pv;
+  vec4 planes[6];
+  double start = riftwm_time();
+
+  // Straight to the overlay: no eye buffers and no warp
+  trace_begin(&r->wm->trace, TRACE_RENDER, TRACE_SCENE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, r->wm->screen_width, r->wm->screen_height);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, r->wm->screen_width >> 1, r->wm->screen_height);
 
+  mat4x4_perspective(proj, RENDERER_MONO_FOV, r->aspect * 2.0f, 0.1f, 1000.0f);
   glMatrixMode(GL_PROJECTION);
-  ohmd_device_getf(r->wm->rift_dev, OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX, mat);
-  glLoadMatrixf(mat);
+  glLoadMatrixf(&proj[0][0]);
+
+  // Pitch, then yaw, as steered by the mouse
+  mat4x4_identity(rot);
+  mat4x4_rotate_X(pv, rot, frame->rot_x);
+  mat4x4_rotate_Y(view, pv, frame->rot_y);
+  mat4x4_translate_in_place(view, frame->pos[0], frame->pos[1], frame->pos[2]);
   glMatrixMode(GL_MODELVIEW);
-  glLoadIdentity();
-  ohmd_device_getf(r->wm->rift_dev, OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX, mat);
-  glLoadMatrixf(mat);
-  glTranslatef(r->pos[0], r->pos[1], r->pos[2]);
-  render_scene(r);
+  glLoadMatrixf(&view[0][0]);
+
+  mat4x4_mul(pv, proj, view);
+  frustum_planes(planes, pv);
+  aabb_cull_batch(frame->visible, planes, frame->bounds, frame->window_count);
+
+  render_scene(r, frame);
+  trace_end(&r->wm->trace, TRACE_RENDER, TRACE_SCENE);
+
+  r->stats.scene_time += riftwm_time() - start;
+  r->stats.frames++;
+}
+
+static void
+warp_eye(renderer_t *r, eye_t eye, fbo_t *fbo, quat now)
+{
+  mat4x4 delta, inv, tmp, tw, layers[RENDERER_LAYERS];
+  GLint units[RENDERER_LAYERS];
+  layer_t *layer;
+  quat conj, q;
+  int i;
+
+  // Rotation from the current head pose back to the one the eye was
+  // rendered with, applied to eye buffer coordinates: P * R * P^-1
+  quat_conj(conj, r->render_quat);
+  quat_mul(q, conj, now);
+  mat4x4_from_quat(delta, q);
+  mat4x4_invert(inv, r->proj[eye]);
+  mat4x4_mul(tmp, delta, inv);
+  mat4x4_mul(tw, r->proj[eye], tmp);
+
+  glUniformMatrix4fv(r->u_timewarp, 1, GL_FALSE, &tw[0][0]);
+
+  // Eye buffer clip space to the local space of each layer's quad, back
+  // to front so that nearer windows cover farther ones
+  for (i = 0; i < r->layer_count; ++i) {
+    layer = &r->layers[r->layer_count - 1 - i];
+    mat4x4_mul(tmp, r->view[eye], layer->model);
+    mat4x4_mul(delta, r->proj[eye], tmp);
+    mat4x4_invert(layers[i], delta);
+    units[i] = i + 1;
+    glActiveTexture(GL_TEXTURE1 + i);
+    glBindTexture(GL_TEXTURE_2D, layer->texture);
+  }
+  glUniform1i(r->u_layer_count, r->layer_count);
+
+  // The inset covers the centre of the eye at full density
+  if (r->wm->foveate) {
+    glActiveTexture(GL_TEXTURE1 + RENDERER_LAYERS);
+    glBindTexture(GL_TEXTURE_2D, r->insets[eye].color);
+    glUniform1i(r->u_inset, 1 + RENDERER_LAYERS);
+    glUniform2fv(r->u_fovea_center, 1, r->distort.lens_center[eye]);
+  }
+  glUniform1f(r->u_fovea, r->wm->foveate ? RENDERER_FOVEA_SIZE : 0.0f);
+
+  // Whatever the eye buffer drew in front of a layer stays on top of it
+  glActiveTexture(GL_TEXTURE2 + RENDERER_LAYERS);
+  glBindTexture(GL_TEXTURE_2D, fbo->depth);
+  glUniform1i(r->u_depth, 2 + RENDERER_LAYERS);
+  glActiveTexture(GL_TEXTURE0);
+  if (r->layer_count) {
+    glUniformMatrix4fv(r->u_layer, r->layer_count, GL_FALSE, &layers[0][0][0]);
+    glUniform1iv(r->u_layer_tex, r->layer_count, units);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, fbo->color);
+  distort_draw(&r->distort, eye, r->a_pos, r->a_tc_r, r->a_tc_g, r->a_tc_b);
+}
+
+static void
+read_timers(renderer_t *r)
+{
+  GLuint64 ns;
+  GLint ready;
+  int i;
+
+  // Oldest first, stopping at the first one the GPU has not reached
+  while (r->timer_pending > 0) {
+    i = (r->timer_next + RENDERER_TIMERS - r->timer_pending) %
+        RENDERER_TIMERS;
+    glGetQueryObjectiv(r->timers[i], GL_QUERY_RESULT_AVAILABLE, &ready);
+    if (!ready) {
+      break;
+    }
+    glGetQueryObjectui64v(r->timers[i], GL_QUERY_RESULT, &ns);
+    r->gpu_time = r->gpu_time * 0.9 + ns * 1e-9 * 0.1;
+    r->stats.gpu_time += ns * 1e-9;
+    r->stats.gpu_frames++;
+    r->timer_pending--;
+  }
+}
+
+static void
+print_stats(renderer_t *r, double now)
+{
+  renderer_stats_t *s = &r->stats;
+
+  if (now - s->since < RENDERER_STATS_PERIOD) {
+    return;
+  }
+
+  if (r->wm->verbose && s->frames > 0) {
+    fprintf(stderr, "Frames: %d, reprojected: %d, scene: %.2fms\n",
+            s->frames, s->reprojected, s->scene_time * 1000.0 / s->frames);
+    if (s->gpu_frames > 0) {
+      fprintf(stderr, "GPU scene: %.2fms\n",
+              s->gpu_time * 1000.0 / s->gpu_frames);
+    }
+    fprintf(stderr, "Textures: %.1fMB of %.1fMB, evictions: %d\n",
+            r->wm->texture_bytes / 1048576.0,
+            r->wm->texture_budget / 1048576.0, r->wm->evictions);
+    if (s->capture_frames > 0) {
+      fprintf(stderr, "Capture: %.2fms, written: %u, dropped: %u\n",
+              s->capture_time * 1000.0 / s->capture_frames,
+              r->capture.written, r->capture.dropped);
+    }
+    if (s->spectator_frames > 0) {
+      fprintf(stderr, "Spectator: %d frames, %.2fms\n", s->spectator_frames,
+              s->spectator_time * 1000.0 / s->spectator_frames);
+    }
+  }
+
+  memset(s, 0, sizeof(renderer_stats_t));
+  s->since = now;
+}
+
+void
+renderer_frame(renderer_t *r, frame_t *frame)
+{
+  double start, end;
+  quat now;
+  int late, timed;
+
+  // Pick up edited shaders between frames
+  if (shaders_poll(&r->shaders)) {
+    warp_locate(r);
+    if (r->wm->passthrough) {
+      passthrough_locate(&r->passthrough);
+    }
+    if (r->batch.supported) {
+      batch_locate(&r->batch);
+    }
+  }
+
+  if (r->wm->mono) {
+    render_mono(r, frame);
+    print_stats(r, riftwm_time());
+    return;
+  }
+
+  // If the scene is not expected to make it before scan-out, re-warp the
+  // previous eye buffers instead. Never skip two frames in a row. Either
+  // the CPU submission or the GPU execution may be the slower one.
+  start = riftwm_time();
+  ohmd_ctx_update(r->wm->rift_ctx);
+  read_timers(r);
+  late = r->has_eyes && !r->reprojected &&
+         (r->scene_time > r->frame_period * RENDERER_BUDGET ||
+          r->gpu_time > r->frame_period * RENDERER_BUDGET);
+
+  if (late) {
+    r->reprojected = 1;
+    r->stats.reprojected++;
+    keep_layers(r, frame);
+  } else {
+    if (r->wm->layers) {
+      select_layers(r, frame);
+    }
+    trace_begin(&r->wm->trace, TRACE_RENDER, TRACE_SCENE);
+    timed = r->timers[0] && r->timer_pending < RENDERER_TIMERS;
+    if (timed) {
+      glBeginQuery(GL_TIME_ELAPSED, r->timers[r->timer_next]);
+    }
+    ohmd_device_getf(r->wm->rift_dev, OHMD_ROTATION_QUAT, r->render_quat);
+    render_eye(r, frame, EYE_LEFT, &r->leftFBO, 0);
+    render_eye(r, frame, EYE_RIGHT, &r->rightFBO, 0);
+    if (r->wm->foveate) {
+      render_eye(r, frame, EYE_LEFT, &r->insets[EYE_LEFT], 1);
+      render_eye(r, frame, EYE_RIGHT, &r->insets[EYE_RIGHT], 1);
+    }
+    if (timed) {
+      glEndQuery(GL_TIME_ELAPSED);
+      r->timer_next = (r->timer_next + 1) % RENDERER_TIMERS;
+      r->timer_pending++;
+    }
+    trace_end(&r->wm->trace, TRACE_RENDER, TRACE_SCENE);
+
+    end = riftwm_time();
+    r->scene_time = r->scene_time * 0.9 + (end - start) * 0.1;
+    r->stats.scene_time += end - start;
+    r->reprojected = 0;
+    r->has_eyes = 1;
+  }
+
+  // Sample the latest orientation right before the warp
+  trace_begin(&r->wm->trace, TRACE_RENDER, TRACE_WARP);
+  ohmd_ctx_update(r->wm->rift_ctx);
+  ohmd_device_getf(r->wm->rift_dev, OHMD_ROTATION_QUAT, now);
+
+  pthread_mutex_lock(&r->lock);
+  memcpy(r->head_quat, now, sizeof(quat));
+  pthread_mutex_unlock(&r->lock);
 
-  // Warp
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   glViewport(0, 0, r->wm->screen_width, r->wm->screen_height);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   glUseProgram(r->warp.prog);
+  warp_eye(r, EYE_LEFT, &r->leftFBO, now);
+  warp_eye(r, EYE_RIGHT, &r->rightFBO, now);
+  glUseProgram(0);
+  trace_end(&r->wm->trace, TRACE_RENDER, TRACE_WARP);
 
-  glUniform1i(r->u_scr_w, r->wm->screen_width >> 1);
-  glUniform1i(r->u_scr_h, r->wm->screen_height);
+  r->stats.frames++;
+  print_stats(r, start);
+}
 
-  glBindTexture(GL_TEXTURE_2D, r->leftFBO.color);
-  glBegin(GL_QUADS);
-    glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, -1.0f);
-    glTexCoord2f(1.0f, 0.0f); glVertex2f( 0.0f, -1.0f);
-    glTexCoord2f(1.0f, 1.0f); glVertex2f( 0.0f,  1.0f);
-    glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f,  1.0f);
-  glEnd();
+static void
+render_spectator(renderer_t *r)
+{
+  riftwm_t *wm = r->wm;
+  GLsync done;
+  double start;
 
-  glBindTexture(GL_TEXTURE_2D, r->rightFBO.color);
-  glBegin(GL_QUADS);
-    glTexCoord2f(0.0f, 0.0f); glVertex2f( 0.0f, -1.0f);
-    glTexCoord2f(1.0f, 0.0f); glVertex2f( 1.0f, -1.0f);
-    glTexCoord2f(1.0f, 1.0f); glVertex2f( 1.0f,  1.0f);
-    glTexCoord2f(0.0f, 1.0f); glVertex2f( 0.0f,  1.0f);
-  glEnd();
+  start = riftwm_time();
+  if (!r->spectator_started || !r->has_eyes ||
+      start - r->spectator_last < 1.0 / wm->spectator_rate)
+  {
+    return;
+  }
 
-  glUseProgram(0);
+  // Skip the refresh while the mirror thread has not taken the last one
+  pthread_mutex_lock(&r->lock);
+  if (r->mirror_ready) {
+    pthread_mutex_unlock(&r->lock);
+    return;
+  }
+  done = r->mirror_done;
+  r->mirror_done = 0;
+  pthread_mutex_unlock(&r->lock);
+  r->spectator_last = start;
+
+  // Scale the left eye into the shared texture once the mirror thread is
+  // done reading it: no second scene render and no context switch here
+  trace_begin(&wm->trace, TRACE_RENDER, TRACE_SPECTATOR);
+  if (done) {
+    glWaitSync(done, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(done);
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, r->leftFBO.fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, r->mirror.fbo);
+  glBlitFramebuffer(0, 0, r->leftFBO.width, r->leftFBO.height,
+                    0, 0, r->mirror.width, r->mirror.height,
+                    GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  pthread_mutex_lock(&r->lock);
+  r->mirror_ready = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+  pthread_cond_signal(&r->spectator_cond);
+  pthread_mutex_unlock(&r->lock);
+  trace_end(&wm->trace, TRACE_RENDER, TRACE_SPECTATOR);
+
+  r->stats.spectator_frames++;
+  r->stats.spectator_time += riftwm_time() - start;
+}
+
+static void *
+spectator_thread(void *arg)
+{
+  renderer_t *r = (renderer_t*)arg;
+  riftwm_t *wm = r->wm;
+  GLsync ready;
+  GLuint fbo;
+
+  // Errors cannot unwind this thread: the mirror just stays black
+  if (!glXMakeCurrent(wm->dpy, wm->spectator, wm->spectator_context)) {
+    fprintf(stderr, "Cannot bind spectator context\n");
+    return NULL;
+  }
+
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, r->mirror.color, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+  for (;;) {
+    pthread_mutex_lock(&r->lock);
+    while (r->running && !r->mirror_ready) {
+      pthread_cond_wait(&r->spectator_cond, &r->lock);
+    }
+    ready = r->mirror_ready;
+    pthread_mutex_unlock(&r->lock);
+    if (!r->running) {
+      break;
+    }
+
+    // The swap may wait for the mirror's vblank, the headset does not
+    glWaitSync(ready, 0, GL_TIMEOUT_IGNORED);
+    glBlitFramebuffer(0, 0, r->mirror.width, r->mirror.height,
+                      0, 0, r->mirror.width, r->mirror.height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    pthread_mutex_lock(&r->lock);
+    glDeleteSync(ready);
+    r->mirror_ready = 0;
+    r->mirror_done = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    pthread_mutex_unlock(&r->lock);
+    glXSwapBuffers(wm->dpy, wm->spectator);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glXMakeCurrent(wm->dpy, None, NULL);
+  return NULL;
+}
+
+static void
+start_spectator(renderer_t *r)
+{
+  riftwm_t *wm = r->wm;
+
+  fbo_init(r, &r->mirror, wm->spectator_width, wm->spectator_height);
+  glFinish();
+
+  r->spectator_started = !pthread_create(&r->spectator_thread, NULL,
+                                         spectator_thread, r);
+  if (!r->spectator_started) {
+    fprintf(stderr, "Cannot create spectator thread\n");
+  }
+}
+
+static void
+stop_spectator(renderer_t *r)
+{
+  if (r->spectator_started) {
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_signal(&r->spectator_cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->spectator_thread, NULL);
+    r->spectator_started = 0;
+  }
+
+  if (r->mirror_ready) {
+    glDeleteSync(r->mirror_ready);
+    r->mirror_ready = 0;
+  }
+  if (r->mirror_done) {
+    glDeleteSync(r->mirror_done);
+    r->mirror_done = 0;
+  }
+  fbo_destroy(r, &r->mirror);
+}
+
+static void
+delete_garbage(renderer_t *r, garbage_t *g)
+{
+  riftwm_t *wm = r->wm;
+
+  if (g->glx_pixmap) {
+    glBindTexture(GL_TEXTURE_2D, g->texture);
+    wm->glXReleaseTexImageEXT(wm->dpy, g->glx_pixmap, GLX_FRONT_LEFT_EXT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glXDestroyPixmap(wm->dpy, g->glx_pixmap);
+  }
+  if (g->pixmap) {
+    XFreePixmap(wm->dpy, g->pixmap);
+  }
+  glDeleteTextures(1, &g->texture);
+}
+
+static frame_t *
+acquire_frame(renderer_t *r)
+{
+  frame_t *tmp;
+  int i, j;
+
+  pthread_mutex_lock(&r->lock);
+  if (r->fresh) {
+    tmp = r->front;
+    r->front = r->ready;
+    r->ready = tmp;
+    r->fresh = 0;
+
+    // Textures removed before this snapshot are not referenced anymore
+    for (i = j = 0; i < r->garbage_count; ++i) {
+      if (r->garbage[i].serial <= r->front->serial) {
+        delete_garbage(r, &r->garbage[i]);
+      } else {
+        r->garbage[j++] = r->garbage[i];
+      }
+    }
+    r->garbage_count = j;
+
+    if (r->wm->passthrough) {
+      passthrough_release(&r->passthrough, r->front->serial);
+    }
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  // Wait on the GPU for the pixmap bindings of the main thread
+  if (r->front->fence) {
+    glWaitSync(r->front->fence, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(r->front->fence);
+    r->front->fence = 0;
+  }
+
+  return r->front;
+}
+
+static void *
+render_thread(void *arg)
+{
+  renderer_t *r = (renderer_t*)arg;
+  riftwm_t *wm = r->wm;
+  frame_t *frame;
+  double start;
+  int i, w, h;
+
+  r->thread = pthread_self();
+  if (setjmp(r->err_jmp)) {
+    pthread_mutex_lock(&r->lock);
+    r->failed = 1;
+    r->running = 0;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    stop_spectator(r);
+    glXMakeCurrent(wm->dpy, None, NULL);
+    return NULL;
+  }
+
+  if (!glXMakeCurrent(wm->dpy, wm->overlay, wm->render_context)) {
+    riftwm_error(wm, "Cannot bind render context");
+  }
+
+  if (!wm->mono) {
+    w = r->eye_width, h = r->eye_height;
+    if (wm->foveate) {
+      w = (int)(r->eye_width * RENDERER_FOVEA_SCALE);
+      h = (int)(r->eye_height * RENDERER_FOVEA_SCALE);
+      for (i = EYE_LEFT; i <= EYE_RIGHT; ++i) {
+        fbo_init(r, &r->insets[i], (int)(r->eye_width * RENDERER_FOVEA_SIZE),
+                 (int)(r->eye_height * RENDERER_FOVEA_SIZE));
+      }
+    }
+    fbo_init(r, &r->leftFBO, w, h);
+    fbo_init(r, &r->rightFBO, w, h);
+    if (GLEW_ARB_timer_query) {
+      glGenQueries(RENDERER_TIMERS, r->timers);
+    }
+    if (wm->spectator) {
+      start_spectator(r);
+    }
+  }
+
+  // Rate of the stream is nominal, each frame carries its own time
+  if (wm->capture_path &&
+      !capture_init(&r->capture, wm->capture_path, wm->screen_width,
+                    wm->screen_height, (int)RENDERER_REFRESH))
+  {
+    riftwm_error(wm, "Cannot capture to %s", wm->capture_path);
+  }
+
+  pthread_mutex_lock(&r->lock);
+  r->started = 1;
+  pthread_cond_signal(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+
+  while (r->running) {
+    trace_begin(&wm->trace, TRACE_RENDER, TRACE_ACQUIRE);
+    frame = acquire_frame(r);
+    trace_end(&wm->trace, TRACE_RENDER, TRACE_ACQUIRE);
+
+    renderer_frame(r, frame);
+
+    // Read back what goes to the headset, without waiting for it
+    if (r->capture.file) {
+      start = riftwm_time();
+      trace_begin(&wm->trace, TRACE_RENDER, TRACE_CAPTURE);
+      capture_frame(&r->capture, start);
+      trace_end(&wm->trace, TRACE_RENDER, TRACE_CAPTURE);
+      r->stats.capture_frames++;
+      r->stats.capture_time += riftwm_time() - start;
+    }
+
+    trace_begin(&wm->trace, TRACE_RENDER, TRACE_SWAP);
+    glXSwapBuffers(wm->dpy, wm->overlay);
+    trace_end(&wm->trace, TRACE_RENDER, TRACE_SWAP);
+
+    // The eye buffers are still intact after the swap
+    render_spectator(r);
+  }
+
+  stop_spectator(r);
+  capture_destroy(&r->capture);
+  fbo_destroy(r, &r->leftFBO);
+  fbo_destroy(r, &r->rightFBO);
+  fbo_destroy(r, &r->insets[EYE_LEFT]);
+  fbo_destroy(r, &r->insets[EYE_RIGHT]);
+  if (r->timers[0]) {
+    glDeleteQueries(RENDERER_TIMERS, r->timers);
+  }
+  glXMakeCurrent(wm->dpy, None, NULL);
+  return NULL;
+}
+
+void
+renderer_start(renderer_t *r)
+{
+  r->running = 1;
+  if (pthread_create(&r->thread, NULL, render_thread, r)) {
+    r->running = 0;
+    riftwm_error(r->wm, "Cannot create render thread");
+  }
+
+  pthread_mutex_lock(&r->lock);
+  while (!r->started && !r->failed) {
+    pthread_cond_wait(&r->cond, &r->lock);
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  // The render thread already stored the message
+  if (r->failed) {
+    pthread_join(r->thread, NULL);
+    longjmp(r->wm->err_jmp, 1);
+  }
+}
+
+void
+renderer_publish(renderer_t *r, GLsync fence)
+{
+  static vec4 CORNERS[4] =
+  {
+    { -1.0f,  1.0f, 0.0f, 1.0f },
+    {  1.0f,  1.0f, 0.0f, 1.0f },
+    {  1.0f, -1.0f, 0.0f, 1.0f },
+    { -1.0f, -1.0f, 0.0f, 1.0f }
+  };
+  riftwm_t *wm = r->wm;
+  frame_t *f = r->back, *tmp;
+  frame_win_t *fw;
+  riftwin_t *win;
+  mat4x4 *overview, model;
+  vec4 corners[4];
+  GLuint texture;
+  float *v, u0, v0, u1, v1, size;
+  int i;
+
+  // Only the current workspace is drawn, except in the overview where
+  // the other workspaces show their thumbnails. Windows evicted for the
+  // texture budget show theirs as well.
+  f->window_count = 0;
+  f->atlas_count = 0;
+  f->atlas = wm->atlas.texture;
+  for (win = wm->windows; win; win = win->next) {
+    texture = win->workspace != wm->workspace ?
+              (wm->overview ? win->thumb : 0) :
+              win->mips ? win->mips :
+              win->texture ? win->texture : win->thumb;
+    if (!win->mapped || !texture) {
+      continue;
+    }
+
+    overview = &wm->workspaces[win->workspace].overview;
+    if (wm->overview) {
+      mat4x4_mul(model, *overview, win->model);
+    } else {
+      mat4x4_dup(model, win->model);
+    }
+
+    // Windows in the atlas become four vertices of one shared batch
+    if (win->atlas && win->workspace == wm->workspace) {
+      if (f->atlas_count >= f->atlas_cap) {
+        f->atlas_cap = f->atlas_cap ? (f->atlas_cap << 1) : 16;
+        assert((f->atlas_verts = (float*)realloc(f->atlas_verts,
+                                 sizeof(float) * 20 * f->atlas_cap)));
+      }
+
+      size = (float)wm->atlas.size;
+      u0 = (win->atlas_pos[0] + 0.5f) / size;
+      v0 = (win->atlas_pos[1] + 0.5f) / size;
+      u1 = (win->atlas_pos[0] + win->width - 0.5f) / size;
+      v1 = (win->atlas_pos[1] + win->height - 0.5f) / size;
+
+      mat4x4_mul_vec4_batch(corners, model, CORNERS, 4);
+      v = &f->atlas_verts[f->atlas_count++ * 20];
+      for (i = 0; i < 4; ++i, v += 5) {
+        v[0] = (i == 1 || i == 2) ? u1 : u0;
+        v[1] = (i >= 2) ? v1 : v0;
+        v[2] = corners[i][0];
+        v[3] = corners[i][1];
+        v[4] = corners[i][2];
+      }
+      continue;
+    }
+
+    if (f->window_count >= f->window_cap) {
+      f->window_cap = f->window_cap ? (f->window_cap << 1) : 16;
+      assert((f->windows = (frame_win_t*)realloc(f->windows,
+                          sizeof(frame_win_t) * f->window_cap)));
+      assert((f->bounds = (aabb_t*)realloc(f->bounds,
+                         sizeof(aabb_t) * f->window_cap)));
+      assert((f->visible = (int*)realloc(f->visible,
+                          sizeof(int) * f->window_cap)));
+    }
+
+    fw = &f->windows[f->window_count];
+    fw->texture = texture;
+    fw->width = win->width;
+    fw->height = win->height;
+    fw->focused = win->focused;
+    fw->translucent = win->depth == 32;
+    mat4x4_dup(fw->model, model);
+    if (wm->overview) {
+      aabb_transform_batch(&f->bounds[f->window_count], overview,
+                           &win->bounds, 1);
+    } else {
+      f->bounds[f->window_count] = win->bounds;
+    }
+    f->window_count++;
+  }
+
+  memcpy(f->pos, r->pos, sizeof(vec3));
+  f->rot_x = r->rot_x;
+  f->rot_y = r->rot_y;
+  memcpy(f->leftHand, r->leftHand, sizeof(f->leftHand));
+  memcpy(f->rightHand, r->rightHand, sizeof(f->rightHand));
+  f->depth_region = wm->passthrough ? r->passthrough.region : -1;
+  if (f->depth_region >= 0) {
+    kinect_calibration(wm->kinect, f->depth_shift);
+    memcpy(f->depth_origin, r->origin, sizeof(f->depth_origin));
+  }
+  f->fence = fence;
+
+  pthread_mutex_lock(&r->lock);
+  f->serial = ++r->serial;
+  if (f->depth_region >= 0) {
+    passthrough_reference(&r->passthrough, f->depth_region, f->serial);
+  }
+  tmp = r->ready;
+  r->ready = f;
+  r->back = tmp;
+
+  // A snapshot that was never drawn is superseded by this one's fence.
+  // Without a fence of its own, this one waits on the older one.
+  if (r->fresh && tmp->fence) {
+    if (f->fence) {
+      glDeleteSync(tmp->fence);
+    } else {
+      f->fence = tmp->fence;
+    }
+    tmp->fence = 0;
+  }
+  r->fresh = 1;
+  pthread_mutex_unlock(&r->lock);
+}
+
+void
+renderer_release(renderer_t *r, GLuint texture)
+{
+  renderer_release_pixmap(r, texture, 0, 0);
+}
+
+void
+renderer_release_pixmap(renderer_t *r, GLuint texture, GLXPixmap glx_pixmap,
+                        Pixmap pixmap)
+{
+  garbage_t g;
+
+  g.texture = texture;
+  g.glx_pixmap = glx_pixmap;
+  g.pixmap = pixmap;
+  if (!r->running) {
+    delete_garbage(r, &g);
+    return;
+  }
+
+  pthread_mutex_lock(&r->lock);
+  if (r->garbage_count >= r->garbage_cap) {
+    r->garbage_cap = r->garbage_cap ? (r->garbage_cap << 1) : 16;
+    assert((r->garbage = (garbage_t*)realloc(r->garbage,
+                         sizeof(garbage_t) * r->garbage_cap)));
+  }
+
+  g.serial = r->serial + 1;
+  r->garbage[r->garbage_count++] = g;
+  pthread_mutex_unlock(&r->lock);
+}
+
+int
+renderer_failed(renderer_t *r)
+{
+  int failed;
+
+  pthread_mutex_lock(&r->lock);
+  failed = r->failed;
+  pthread_mutex_unlock(&r->lock);
+  return failed;
+}
+
+void
+renderer_orientation(renderer_t *r, quat q)
+{
+  pthread_mutex_lock(&r->lock);
+  memcpy(q, r->head_quat, sizeof(quat));
+  pthread_mutex_unlock(&r->lock);
+}
+
+void
+renderer_stop(renderer_t *r)
+{
+  int i;
+
+  if (r->running) {
+    r->running = 0;
+    pthread_join(r->thread, NULL);
+  }
+
+  for (i = 0; i < r->garbage_count; ++i) {
+    delete_garbage(r, &r->garbage[i]);
+  }
+  r->garbage_count = 0;
 }
 
 void
 renderer_destroy(renderer_t *r)
 {
+  int i;
+
   if (r) {
+    renderer_stop(r);
+    for (i = 0; i < RENDERER_FRAMES; ++i) {
+      if (r->frames[i].fence) {
+        glDeleteSync(r->frames[i].fence);
+      }
+      free(r->frames[i].windows);
+      free(r->frames[i].bounds);
+      free(r->frames[i].visible);
+      free(r->frames[i].atlas_verts);
+    }
+    free(r->garbage);
+    free(r->draws);
+
+    distort_destroy(&r->distort);
+    if (r->wm->passthrough) {
+      passthrough_destroy(&r->passthrough);
+    }
+    batch_destroy(&r->batch);
+    shaders_destroy(&r->shaders);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    pthread_cond_destroy(&r->spectator_cond);
     free(r);
   }
 }
@@ -4,20 +4,136 @@
 #ifndef __RENDERER_H__
 #define __RENDERER_H__
 
+#include <pthread.h>
+#include <setjmp.h>
 #include "linmath.h"
+#include "linmath_batch.h"
+#include "distort.h"
+#include "shader.h"
+#include "capture.h"
+#include "passthrough.h"
+#include "batch.h"
 
-typedef struct shader_t
+// Display refresh rate of the headset
+#define RENDERER_REFRESH 60.0
+// Fraction of the frame the scene may take before reprojection kicks in
+#define RENDERER_BUDGET 0.8
+// Interval between statistics reports, in seconds
+#define RENDERER_STATS_PERIOD 5.0
+// Number of frame snapshots: one written, one ready, one drawn
+#define RENDERER_FRAMES 3
+// GPU timer queries in flight, read back a frame or more later
+#define RENDERER_TIMERS 4
+// Number of environment textures
+#define RENDERER_TEXTURES 7
+// Vertical field of view without a headset, in radians
+#define RENDERER_MONO_FOV 1.1f
+// Windows sampled directly by the warp pass, must match warp.fs.glsl
+#define RENDERER_LAYERS 4
+// Distance beyond which windows stay in the eye buffers
+#define RENDERER_LAYER_DISTANCE 12.0f
+// Foveated eyes: size of the full density inset around the lens centre,
+// as a fraction of the eye, and resolution of the periphery
+#define RENDERER_FOVEA_SIZE 0.5f
+#define RENDERER_FOVEA_SCALE 0.5f
+
+typedef struct texture_t
 {
-  GLuint prog;
-} shader_t;
+  GLuint            tex;
+  const char       *src;
+  int               width;
+  int               height;
+} texture_t;
 
 typedef struct fbo_t
 {
   GLuint fbo;
   GLuint depth;
   GLuint color;
+  int    width;
+  int    height;
 } fbo_t;
 
+typedef struct frame_win_t
+{
+  GLuint            texture;
+  int               width;
+  int               height;
+  mat4x4            model;
+  int               focused;
+  int               translucent;
+} frame_win_t;
+
+// Window in the draw order of one eye
+typedef struct draw_t
+{
+  int               index;
+  int               translucent;
+  float             depth;
+} draw_t;
+
+// Window composited in the warp pass rather than drawn into the eye buffers
+typedef struct layer_t
+{
+  int               index;
+  GLuint            texture;
+  mat4x4            model;
+  float             distance;
+} layer_t;
+
+// Immutable copy of everything the render thread needs for one frame
+typedef struct frame_t
+{
+  unsigned          serial;
+  GLsync            fence;
+  vec3              pos;
+  float             rot_x;
+  float             rot_y;
+  float             leftHand[3];
+  float             rightHand[3];
+
+  // Depth frame to draw as points, -1 for none, and its calibration
+  int               depth_region;
+  float             depth_shift[3];
+  float             depth_origin[3];
+
+  frame_win_t      *windows;
+  aabb_t           *bounds;
+  int              *visible;
+  int               window_count;
+  int               window_cap;
+
+  // World space quads of the windows in the atlas, as T2F_V3F vertices
+  GLuint            atlas;
+  float            *atlas_verts;
+  int               atlas_count;
+  int               atlas_cap;
+} frame_t;
+
+// Texture that can be deleted once a frame newer than serial is drawn,
+// with the pixmap bound to it if any
+typedef struct garbage_t
+{
+  GLuint            texture;
+  GLXPixmap         glx_pixmap;
+  Pixmap            pixmap;
+  unsigned          serial;
+} garbage_t;
+
+typedef struct renderer_stats_t
+{
+  double            since;
+  int               frames;
+  int               reprojected;
+  double            scene_time;
+  int               gpu_frames;
+  double            gpu_time;
+  int               spectator_frames;
+  double            spectator_time;
+  int               capture_frames;
+  double            capture_time;
+} renderer_stats_t;
+
 typedef struct renderer_t
 {
   float             rot_x;
@@ -28,7 +144,12 @@ typedef struct renderer_t
 
   fbo_t             leftFBO;
   fbo_t             rightFBO;
+  fbo_t             insets[2];
+  shaders_t         shaders;
   shader_t          warp;
+  distort_t         distort;
+  passthrough_t     passthrough;
+  batch_t           batch;
 
   GLuint            floor;
   GLuint            sky_xn;
@@ -37,21 +158,92 @@ typedef struct renderer_t
   GLuint            sky_yp;
   GLuint            sky_zn;
   GLuint            sky_zp;
+  texture_t         textures[RENDERER_TEXTURES];
+  int               texture_count;
 
   int               has_origin;
   float             origin[3];
   float             leftHand[3];
   float             rightHand[3];
 
-  GLint             u_scr_w;
-  GLint             u_scr_h;
+  GLint             a_pos;
+  GLint             a_tc_r;
+  GLint             a_tc_g;
+  GLint             a_tc_b;
+  GLint             u_timewarp;
+  GLint             u_layer_count;
+  GLint             u_layer;
+  GLint             u_layer_tex;
+  GLint             u_depth;
+  GLint             u_fovea;
+  GLint             u_fovea_center;
+  GLint             u_inset;
+
+  quat              render_quat;
+  mat4x4            proj[2];
+  mat4x4            view[2];
+  int               eye_width;
+  int               eye_height;
+  layer_t           layers[RENDERER_LAYERS];
+  int               layer_count;
+  int               has_eyes;
+  int               reprojected;
+  double            frame_period;
+  double            spectator_last;
+
+  // Mirror thread, bound once to the spectator window. The left eye is
+  // scaled into a shared texture, fences order the two contexts.
+  pthread_t         spectator_thread;
+  pthread_cond_t    spectator_cond;
+  int               spectator_started;
+  fbo_t             mirror;
+  GLsync            mirror_ready;
+  GLsync            mirror_done;
+  capture_t         capture;
+  double            scene_time;
+  renderer_stats_t  stats;
+
+  // Scene time on the GPU, which submission time does not show when the
+  // GPU is the bottleneck
+  GLuint            timers[RENDERER_TIMERS];
+  int               timer_next;
+  int               timer_pending;
+  double            gpu_time;
+
+  // Render thread and the snapshots shared with it
+  pthread_t         thread;
+  pthread_mutex_t   lock;
+  pthread_cond_t    cond;
+  jmp_buf           err_jmp;
+  volatile int      running;
+  int               started;
+  int               failed;
+  frame_t           frames[RENDERER_FRAMES];
+  frame_t          *back;
+  frame_t          *ready;
+  frame_t          *front;
+  int               fresh;
+  unsigned          serial;
+  garbage_t        *garbage;
+  int               garbage_count;
+  int               garbage_cap;
+  draw_t           *draws;
+  int               draw_cap;
+  quat              head_quat;
 
   float             aspect;
   riftwm_t         *wm;
 } renderer_t;
 
 renderer_t *renderer_init(riftwm_t *wm);
-void renderer_frame(renderer_t *);
+void renderer_start(renderer_t *);
+void renderer_publish(renderer_t *, GLsync);
+void renderer_release(renderer_t *, GLuint);
+void renderer_release_pixmap(renderer_t *, GLuint, GLXPixmap, Pixmap);
+int renderer_failed(renderer_t *);
+void renderer_orientation(renderer_t *, quat);
+void renderer_frame(renderer_t *, frame_t *);
+void renderer_stop(renderer_t *);
 void renderer_destroy(renderer_t *);
 
 #endif /*__RENDERER_H__*/
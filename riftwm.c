@@ -10,6 +10,9 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <IL/il.h>
@@ -17,6 +20,7 @@
 #include "riftwm.h"
 #include "renderer.h"
 #include "kinect.h"
+#include "handoff.h"
 
 // -----------------------------------------------------------------------------
 // Unique instance referenced by signal handlers
@@ -26,23 +30,15 @@ static riftwm_t wm;
 // -----------------------------------------------------------------------------
 // Internal stuff
 // -----------------------------------------------------------------------------
-static void
-create_texture(riftwm_t *wm, riftwin_t *win)
+static layout_t *
+win_layout(riftwm_t *wm, riftwin_t *win)
 {
-  XWindowAttributes attr;
-
-  // Retrieve properties
-  if (!XGetWindowAttributes(wm->dpy, win->window, &attr)) {
-    riftwm_error(wm, "Cannot retrieve window attributes");
-  }
-
-  win->width = attr.width;
-  win->height = attr.height;
-  if (attr.map_state != IsViewable) {
-    return;
-  }
+  return &wm->workspaces[win->workspace].layout;
+}
 
-  // Free old resources
+static void
+release_pixmap(riftwm_t *wm, riftwin_t *win)
+{
   if (win->glx_pixmap) {
     glBindTexture(GL_TEXTURE_2D, win->texture);
     wm->glXReleaseTexImageEXT(wm->dpy, win->glx_pixmap, GLX_FRONT_LEFT_EXT);
@@ -56,38 +52,471 @@ create_texture(riftwm_t *wm, riftwin_t *win)
     XFreePixmap(wm->dpy, win->pixmap);
     win->pixmap = 0;
   }
+}
+
+static void
+drop_texture(riftwm_t *wm, riftwin_t *win)
+{
+  // The render thread may still be sampling the texture, the pixmap bound
+  // to it goes away with it once no snapshot refers to it
+  if (win->texture) {
+    renderer_release_pixmap(wm->renderer, win->texture, win->glx_pixmap,
+                            win->pixmap);
+    win->texture = 0;
+    win->glx_pixmap = 0;
+    win->pixmap = 0;
+  }
+  release_pixmap(wm, win);
+}
 
-  if (!win->texture) {
-    glGenTextures(1, &win->texture);
+static void
+box_union(int box[4], int x0, int y0, int x1, int y1)
+{
+  if (box[0] >= box[2] || box[1] >= box[3]) {
+    box[0] = x0;
+    box[1] = y0;
+    box[2] = x1;
+    box[3] = y1;
+  } else {
+    box[0] = x0 < box[0] ? x0 : box[0];
+    box[1] = y0 < box[1] ? y0 : box[1];
+    box[2] = x1 > box[2] ? x1 : box[2];
+    box[3] = y1 > box[3] ? y1 : box[3];
   }
+}
 
-  // Retrieve the pixmap from the XComposite
-  win->pixmap = XCompositeNameWindowPixmap(wm->dpy, win->window);
+static void
+damage_all(riftwin_t *win)
+{
+  box_union(win->damage_box, 0, 0, win->width, win->height);
+  win->damaged = 1;
+}
+
+static void
+blit_texture(riftwm_t *wm, GLuint src, int src_level, int sx, int sy,
+             int sw, int sh, GLuint dst, int dst_level, int dx, int dy,
+             int dw, int dh)
+{
+  if (!wm->copy_fbo[0]) {
+    glGenFramebuffers(2, wm->copy_fbo);
+  }
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, wm->copy_fbo[0]);
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, src, src_level);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, wm->copy_fbo[1]);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, dst, dst_level);
+  glBlitFramebuffer(sx, sy, sx + sw, sy + sh, dx, dy, dx + dw, dy + dh,
+                    GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, 0, 0);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, 0, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static int
+atlas_place(riftwm_t *wm, riftwin_t *win)
+{
+  riftwin_t *other;
+
+  if (atlas_alloc(&wm->atlas, win->width, win->height, win->atlas_pos)) {
+    return 1;
+  }
+
+  // Out of room: pack the windows still in the atlas again from scratch.
+  // Those that no longer fit go back to drawing their own texture.
+  atlas_reset(&wm->atlas);
+  for (other = wm->windows; other; other = other->next) {
+    if (other != win && other->atlas) {
+      other->atlas = atlas_alloc(&wm->atlas, other->width, other->height,
+                                 other->atlas_pos);
+      damage_all(other);
+    }
+  }
+
+  return atlas_alloc(&wm->atlas, win->width, win->height, win->atlas_pos);
+}
+
+static void
+release_mips(riftwm_t *wm, riftwin_t *win)
+{
+  if (win->mips) {
+    renderer_release(wm->renderer, win->mips);
+    win->mips = 0;
+  }
+
+  win->mip_levels = 0;
+  win->mip_next = 0;
+}
+
+static void
+create_mips(riftwm_t *wm, riftwin_t *win)
+{
+  int levels, size, i;
+
+  levels = 1;
+  size = win->width > win->height ? win->width : win->height;
+  for (; size > 1; size >>= 1) {
+    ++levels;
+  }
+
+  if (!win->mips) {
+    glGenTextures(1, &win->mips);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, win->mips);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  if (wm->anisotropy > 1.0f) {
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+                    wm->anisotropy);
+  }
+  for (i = 0; i < levels; ++i) {
+    glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA,
+                 win->width >> i > 0 ? win->width >> i : 1,
+                 win->height >> i > 0 ? win->height >> i : 1,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  win->mip_levels = levels;
+  win->mip_next = 0;
+}
+
+static long
+mip_budget(riftwm_t *wm)
+{
+  GLuint64 elapsed;
+  GLint ready = 0;
+
+  if (!GLEW_ARB_timer_query) {
+    return (long)(RIFTWM_MIP_BUDGET * RIFTWM_MIP_RATE);
+  }
+  if (!wm->mip_query) {
+    glGenQueries(1, &wm->mip_query);
+    wm->mip_rate = RIFTWM_MIP_RATE;
+  }
+
+  // The blits of the previous tick are timed on the GPU, their result is
+  // only used once available so the main thread never stalls on it
+  if (wm->mip_texels) {
+    glGetQueryObjectiv(wm->mip_query, GL_QUERY_RESULT_AVAILABLE, &ready);
+    if (!ready) {
+      return 0;
+    }
+    glGetQueryObjectui64v(wm->mip_query, GL_QUERY_RESULT, &elapsed);
+    if (elapsed > 0) {
+      wm->mip_rate = 0.8 * wm->mip_rate +
+                     0.2 * wm->mip_texels / (elapsed * 1e-6);
+    }
+    wm->mip_texels = 0;
+  }
+
+  return (long)(RIFTWM_MIP_BUDGET * wm->mip_rate);
+}
+
+static int
+update_mipmaps(riftwm_t *wm)
+{
+  long budget, texels = 0;
+  int x0, y0, x1, y1, sw, sh, w, h, level, progress, updated = 0;
+  riftwin_t *win;
+
+  for (win = wm->windows; win && !(win->mips && win->mip_next); ) {
+    win = win->next;
+  }
+  if (!win || (budget = mip_budget(wm)) <= 0) {
+    return 0;
+  }
+  if (wm->mip_query) {
+    glBeginQuery(GL_TIME_ELAPSED, wm->mip_query);
+  }
+
+  // Each pass rebuilds one level of every window with pending work, so a
+  // busy window cannot starve the others. Whatever does not fit in the
+  // budget is carried over to the next tick.
+  do {
+    progress = 0;
+    for (win = wm->windows; win && texels < budget; win = win->next) {
+      if (!win->mips || !win->mip_next) {
+        continue;
+      }
+
+      level = win->mip_next;
+      sw = win->width >> (level - 1) > 0 ? win->width >> (level - 1) : 1;
+      sh = win->height >> (level - 1) > 0 ? win->height >> (level - 1) : 1;
+      w = win->width >> level > 0 ? win->width >> level : 1;
+      h = win->height >> level > 0 ? win->height >> level : 1;
+      x0 = win->mip_box[0] >> level;
+      y0 = win->mip_box[1] >> level;
+      x1 = (win->mip_box[2] + (1 << level) - 1) >> level;
+      y1 = (win->mip_box[3] + (1 << level) - 1) >> level;
+      x1 = x1 < w ? x1 : w;
+      y1 = y1 < h ? y1 : h;
+
+      // 2:1 linear blit of the rectangle from the level above, which is
+      // only one texel wide or high once that side has bottomed out
+      sw = (x1 << 1 < sw ? x1 << 1 : sw) - (x0 << 1);
+      sh = (y1 << 1 < sh ? y1 << 1 : sh) - (y0 << 1);
+      blit_texture(wm, win->mips, level - 1, x0 << 1, y0 << 1, sw, sh,
+                   win->mips, level, x0, y0, x1 - x0, y1 - y0);
+      texels += (long)sw * sh;
+
+      if (++win->mip_next >= win->mip_levels) {
+        win->mip_next = 0;
+        memset(win->mip_box, 0, sizeof(win->mip_box));
+      }
+      progress = updated = 1;
+    }
+  } while (progress && texels < budget);
+
+  if (wm->mip_query) {
+    glEndQuery(GL_TIME_ELAPSED);
+    wm->mip_texels = texels > 0 ? texels : 1;
+  }
+
+  return updated;
+}
+
+static void
+create_texture(riftwm_t *wm, riftwin_t *win)
+{
+  XWindowAttributes attr;
 
-  // Create a backing OpenGL pixmap
-  const int ATTR[] =
+  // Retrieve properties
+  if (!XGetWindowAttributes(wm->dpy, win->window, &attr)) {
+    riftwm_error(wm, "Cannot retrieve window attributes");
+  }
+
+  // Only this window is fitted into its cell again. Menus also follow
+  // moves, their offset from the parent comes from the position.
+  if (attr.width != win->width || attr.height != win->height ||
+      attr.x != win->x || attr.y != win->y)
   {
-    GLX_TEXTURE_FORMAT_EXT, GLX_TEXTURE_FORMAT_RGBA_EXT,
-    GLX_TEXTURE_TARGET_EXT, GLX_TEXTURE_2D_EXT,
-    None
-  };
+    win->width = attr.width;
+    win->height = attr.height;
+    win->x = attr.x;
+    win->y = attr.y;
+    layout_resize(win_layout(wm, win), win);
+  }
 
-  if (!(win->glx_pixmap = glXCreatePixmap(wm->dpy, wm->fb_config[1].config,
-                                          win->pixmap, ATTR)))
+  // Hidden workspaces bind nothing until they are shown again, neither
+  // do windows evicted to stay within the texture budget
+  if (attr.map_state != IsViewable || win->workspace != wm->workspace ||
+      win->evicted)
   {
-    riftwm_error(wm, "Cannot create GLX pixmap");
+    return;
   }
 
+  // Older snapshots may still sample the old texture: it goes away with
+  // its pixmap once they are drawn, the new pixmap gets a fresh name
+  drop_texture(wm, win);
+  glGenTextures(1, &win->texture);
+
+  // Retrieve the pixmap from the XComposite
+  win->pixmap = XCompositeNameWindowPixmap(wm->dpy, win->window);
+  win->depth = attr.depth;
+  win->visual = attr.visual;
+
   // Create the texture
   glBindTexture(GL_TEXTURE_2D, win->texture);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  wm->glXBindTexImageEXT(wm->dpy, win->glx_pixmap, GLX_FRONT_LEFT_EXT, NULL);
+
+  if (wm->streaming) {
+    // Plain storage, filled by refresh_texture; opaque windows get no alpha
+    glTexImage2D(GL_TEXTURE_2D, 0, win->depth == 32 ? GL_RGBA8 : GL_RGB8,
+                 win->width, win->height, 0, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+  } else {
+    // Create a backing OpenGL pixmap
+    const int ATTR[] =
+    {
+      GLX_TEXTURE_FORMAT_EXT, GLX_TEXTURE_FORMAT_RGBA_EXT,
+      GLX_TEXTURE_TARGET_EXT, GLX_TEXTURE_2D_EXT,
+      None
+    };
+
+    if (!(win->glx_pixmap = glXCreatePixmap(wm->dpy, wm->fb_config[1].config,
+                                            win->pixmap, ATTR)))
+    {
+      glBindTexture(GL_TEXTURE_2D, 0);
+      riftwm_error(wm, "Cannot create GLX pixmap");
+    }
+
+    wm->glXBindTexImageEXT(wm->dpy, win->glx_pixmap, GLX_FRONT_LEFT_EXT, NULL);
+  }
   glBindTexture(GL_TEXTURE_2D, 0);
 
+  // Small windows are copied into the shared atlas and drawn from there.
+  // The atlas is drawn with the opaque windows, translucent ones keep
+  // their own texture to be blended.
+  win->atlas = win->depth != 32 && win->width <= ATLAS_MAX_WINDOW &&
+               win->height <= ATLAS_MAX_WINDOW && atlas_place(wm, win);
+
+  // Other windows are drawn from a copy with a mip chain, unless the
+  // texture budget took it away
+  if (!win->atlas && win->mipmaps) {
+    create_mips(wm, win);
+  } else {
+    release_mips(wm, win);
+  }
+
+  // Track changes to the contents from now on
+  if (!win->damage) {
+    win->damage = XDamageCreate(wm->dpy, win->window, XDamageReportNonEmpty);
+  }
+
   win->dirty = 0;
+  damage_all(win);
+}
+
+static void
+refresh_texture(riftwm_t *wm, riftwin_t *win)
+{
+  int *box = win->damage_box, x0, y0, x1, y1, rows;
+
+  // Only the damaged rectangle is copied out of the pixmap
+  x0 = box[0] > 0 ? box[0] : 0;
+  y0 = box[1] > 0 ? box[1] : 0;
+  x1 = box[2] < win->width ? box[2] : win->width;
+  y1 = box[3] < win->height ? box[3] : win->height;
+  memset(win->damage_box, 0, sizeof(win->damage_box));
+  win->damaged = 0;
+
+  if (wm->streaming) {
+    // Read back through shared memory, the texture is ours to update
+    if (x0 >= x1 || y0 >= y1 ||
+        (rows = upload_rect(&wm->upload, win->pixmap, win->visual,
+                            win->depth, win->texture, x0, y0, x1 - x0,
+                            y1 - y0)) < 0)
+    {
+      return;
+    }
+
+    // Rows the staging ring had no room for stay damaged
+    if (y0 + rows < y1) {
+      box_union(win->damage_box, x0, y0 + rows, x1, y1);
+      win->damaged = 1;
+      y1 = y0 + rows;
+    }
+    if (!rows) {
+      return;
+    }
+  } else {
+    // Rebinding makes the new contents of the pixmap visible to GL
+    glBindTexture(GL_TEXTURE_2D, win->texture);
+    wm->glXReleaseTexImageEXT(wm->dpy, win->glx_pixmap, GLX_FRONT_LEFT_EXT);
+    wm->glXBindTexImageEXT(wm->dpy, win->glx_pixmap, GLX_FRONT_LEFT_EXT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (x0 >= x1 || y0 >= y1) {
+      return;
+    }
+  }
+
+  if (win->atlas) {
+    blit_texture(wm, win->texture, 0, x0, y0, x1 - x0, y1 - y0,
+                 wm->atlas.texture, 0, win->atlas_pos[0] + x0,
+                 win->atlas_pos[1] + y0, x1 - x0, y1 - y0);
+  } else if (win->mips) {
+    blit_texture(wm, win->texture, 0, x0, y0, x1 - x0, y1 - y0,
+                 win->mips, 0, x0, y0, x1 - x0, y1 - y0);
+
+    // The smaller levels follow within the mip budget
+    if (win->mip_levels > 1) {
+      box_union(win->mip_box, x0, y0, x1, y1);
+      win->mip_next = 1;
+    }
+  }
+}
+
+static void
+create_thumbnail(riftwm_t *wm, riftwin_t *win)
+{
+  int width, height, size;
+
+  size = win->width > win->height ? win->width : win->height;
+  if (size <= 0) {
+    return;
+  }
+
+  width = win->width;
+  height = win->height;
+  if (size > RIFTWM_THUMB_SIZE) {
+    width = width * RIFTWM_THUMB_SIZE / size;
+    height = height * RIFTWM_THUMB_SIZE / size;
+  }
+  width = width > 0 ? width : 1;
+  height = height > 0 ? height : 1;
+
+  if (!win->thumb) {
+    glGenTextures(1, &win->thumb);
+    glBindTexture(GL_TEXTURE_2D, win->thumb);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+
+  if (width != win->thumb_width || height != win->thumb_height) {
+    glBindTexture(GL_TEXTURE_2D, win->thumb);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, 0);
+    win->thumb_width = width;
+    win->thumb_height = height;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // Scale the window contents down on the GPU
+  blit_texture(wm, win->texture, 0, 0, 0, win->width, win->height,
+               win->thumb, 0, 0, 0, width, height);
+}
+
+static void
+update_bytes(riftwm_t *wm, riftwin_t *win)
+{
+  size_t bytes, base;
+
+  // The bound pixmap, the mipmapped copy and the thumbnail, at 32 bpp
+  bytes = (size_t)win->thumb_width * win->thumb_height * 4;
+  if (win->pixmap) {
+    base = (size_t)win->width * win->height * 4;
+    bytes += win->mips ? base + base + base / 3 : base;
+  }
+
+  wm->texture_bytes += bytes - win->bytes;
+  win->bytes = bytes;
+}
+
+static void
+suspend_window(riftwm_t *wm, riftwin_t *win)
+{
+  if (!win->pixmap) {
+    return;
+  }
+
+  // Keep a small copy for the overview, then let go of everything else
+  create_thumbnail(wm, win);
+
+  if (win->damage) {
+    XDamageDestroy(wm->dpy, win->damage);
+    win->damage = 0;
+  }
+
+  drop_texture(wm, win);
+  release_mips(wm, win);
+  win->atlas = 0;
+  win->damaged = 0;
+  update_bytes(wm, win);
 }
 
 static riftwin_t *
@@ -118,39 +547,55 @@ add_window(riftwm_t *wm, Window window)
     win->next = wm->windows;
     win->dirty = 1;
     win->mapped = 0;
-    win->focused = 1;
-    win->pos[0] = 0.0f;
-    win->pos[1] = 0.0f;
-    win->pos[2] = 5.0f;
+    win->focused = 0;
+    win->cell = -1;
+    win->anim = -1;
+    win->workspace = wm->workspace;
+    win->mipmaps = 1;
 
     wm->windows = win;
     wm->window_count++;
+
+    // Properties are read with the next batch, then only when they change
+    XSelectInput(wm->dpy, window, PropertyChangeMask | FocusChangeMask);
+    win->props_pending = EWMH_PROPS_ALL;
   }
 
   return win;
 }
 
 static void
-free_window(riftwm_t *wm, riftwin_t *win)
+focus_window(riftwm_t *wm, riftwin_t *focus)
 {
-  if (win->glx_pixmap) {
-    glBindTexture(GL_TEXTURE_2D, win->texture);
-    wm->glXReleaseTexImageEXT(wm->dpy, win->glx_pixmap, GLX_FRONT_LEFT_EXT);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glXDestroyPixmap(wm->dpy, win->glx_pixmap);
-    win->glx_pixmap = 0;
+  riftwin_t *win;
+
+  // Only one window is focused: it gets keys and the larger refresh share
+  for (win = wm->windows; win; win = win->next) {
+    win->focused = win == focus;
   }
+}
 
-  if (win->pixmap) {
-    XFreePixmap(wm->dpy, win->pixmap);
-    win->pixmap = 0;
+static void
+free_window(riftwm_t *wm, riftwin_t *win)
+{
+  layout_remove(win_layout(wm, win), win);
+
+  if (win->damage) {
+    XDamageDestroy(wm->dpy, win->damage);
+    win->damage = 0;
   }
 
-  if (win->texture) {
-    glDeleteTextures(1, &win->texture);
-    win->texture = 0;
+  drop_texture(wm, win);
+  if (win->thumb) {
+    renderer_release(wm->renderer, win->thumb);
+    win->thumb = 0;
   }
 
+  release_mips(wm, win);
+  wm->texture_bytes -= win->bytes;
+
+  free(win->name);
+  free(win->wm_class);
   free(win);
 }
 
@@ -178,46 +623,418 @@ destroy_window(riftwm_t *wm, Window window)
   }
 }
 
-static void
+static int
 update_window(riftwm_t *wm, riftwin_t *win)
 {
+  return riftwin_update(wm, win);
+}
+
+static void
+update_depth(riftwm_t *wm)
+{
+  const uint16_t *depth;
+  unsigned serial;
+  int w, h;
+
+  // Only complete VGA frames fit the point grid
+  if (!(depth = kinect_depth(wm->kinect, &w, &h, &serial)) ||
+      serial == wm->depth_serial ||
+      w != PASSTHROUGH_WIDTH || h != PASSTHROUGH_HEIGHT)
+  {
+    return;
+  }
+
+  wm->depth_serial = serial;
+  passthrough_upload(&wm->renderer->passthrough, depth);
+  wm->gl_pending = 1;
+}
+
+static int
+refresh_compare(const void *a, const void *b)
+{
+  return (*(riftwin_t**)b)->credit - (*(riftwin_t**)a)->credit;
+}
+
+static int
+refresh_windows(riftwm_t *wm)
+{
+  double now = riftwm_time();
+  riftwin_t *win;
+  int i, count = 0;
+
+  if (wm->refresh_cap < wm->window_count) {
+    wm->refresh_cap = wm->window_count << 1;
+    assert((wm->refresh = (riftwin_t**)realloc(wm->refresh,
+                          sizeof(riftwin_t*) * wm->refresh_cap)));
+  }
+
+  // Windows due for a refresh earn credit by weight every tick they wait,
+  // so busy clients take turns with the others instead of starving them
+  for (win = wm->windows; win; win = win->next) {
+    if (!win->damaged || !win->pixmap ||
+        (win->max_fps > 0.0f && now - win->last_refresh < 1.0 / win->max_fps))
+    {
+      continue;
+    }
+    win->credit += win->focused ? RIFTWM_FOCUS_WEIGHT :
+                   win->viewed ? RIFTWM_VIEW_WEIGHT : 1;
+    wm->refresh[count++] = win;
+  }
+  qsort(wm->refresh, count, sizeof(riftwin_t*), refresh_compare);
+
+  // Highest credit first until the budget runs out, leaving the damage of
+  // the rest for the next tick. One window always gets through.
+  for (i = 0; i < count; ++i) {
+    if (i > 0 && riftwm_time() - now > RIFTWM_REFRESH_BUDGET) {
+      break;
+    }
+    win = wm->refresh[i];
+    refresh_texture(wm, win);
+    update_bytes(wm, win);
+    win->credit = 0;
+    win->last_refresh = now;
+  }
+
+  return i > 0;
 }
 
 static void
 update_windows(riftwm_t *wm)
 {
+  GLsync fence = 0;
+  int updated = wm->gl_pending;
+
   riftwin_t *win = wm->windows;
   while (win) {
-    update_window(wm, win);
+    updated |= update_window(wm, win);
     win = win->next;
   }
+  updated |= refresh_windows(wm);
+  updated |= update_mipmaps(wm);
+
+  // Let the render thread wait for the new bindings on the GPU
+  if (updated) {
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    wm->gl_pending = 0;
+  }
+
+  renderer_publish(wm->renderer, fence);
+}
+
+static riftwin_t *
+least_recently_viewed(riftwm_t *wm, int mipmaps)
+{
+  riftwin_t *win, *lru = NULL;
+
+  for (win = wm->windows; win; win = win->next) {
+    if (win->workspace != wm->workspace || !win->pixmap ||
+        win->viewed || (win->mips != 0) != mipmaps)
+    {
+      continue;
+    }
+    if (!lru || win->last_viewed < lru->last_viewed) {
+      lru = win;
+    }
+  }
+
+  return lru;
+}
+
+static void
+update_residency(riftwm_t *wm, quat head)
+{
+  mat4x4 proj, rot, view, pv;
+  vec4 planes[6];
+  riftwin_t *win;
+  size_t full;
+  double now;
+  quat conj;
+  int i, n;
+
+  if (!wm->texture_budget) {
+    return;
+  }
+
+  // Windows of the current workspace within a generous view frustum
+  if (wm->view_cap < wm->window_count) {
+    wm->view_cap = wm->window_count << 1;
+    assert((wm->view_bounds = (aabb_t*)realloc(wm->view_bounds,
+                              sizeof(aabb_t) * wm->view_cap)));
+    assert((wm->view_visible = (int*)realloc(wm->view_visible,
+                               sizeof(int) * wm->view_cap)));
+  }
+
+  n = 0;
+  for (win = wm->windows; win; win = win->next) {
+    wm->view_bounds[n++] = win->bounds;
+  }
+
+  quat_conj(conj, head);
+  mat4x4_from_quat(rot, conj);
+  mat4x4_dup(view, rot);
+  mat4x4_translate_in_place(view, wm->renderer->pos[0], wm->renderer->pos[1],
+                            wm->renderer->pos[2]);
+  mat4x4_perspective(proj, RIFTWM_VIEW_FOV, wm->renderer->aspect * 2.0f,
+                     0.1f, 1000.0f);
+  mat4x4_mul(pv, proj, view);
+  frustum_planes(planes, pv);
+  aabb_cull_batch(wm->view_visible, planes, wm->view_bounds, n);
+
+  // Windows coming into view get their textures back first
+  now = riftwm_time();
+  for (win = wm->windows, i = 0; win; win = win->next, ++i) {
+    win->viewed = wm->view_visible[i] && win->mapped && !win->unplaced &&
+                  win->workspace == wm->workspace;
+    if (!win->viewed) {
+      continue;
+    }
+    win->last_viewed = now;
+
+    // The mipmapped copy costs a third more than the pixmap itself
+    full = (size_t)win->width * win->height * 4;
+    full += full / 3;
+    if (win->evicted) {
+      win->evicted = 0;
+      win->mipmaps = wm->texture_bytes + full * 2 <= wm->texture_budget;
+      win->dirty = 1;
+    } else if (!win->mipmaps && win->pixmap &&
+               wm->texture_bytes + full <= wm->texture_budget)
+    {
+      win->mipmaps = 1;
+      win->dirty = 1;
+    }
+  }
+
+  // Then whatever has not been looked at for longest gives up its mip
+  // chain, and after that its pixmap, until the budget is met
+  while (wm->texture_bytes > wm->texture_budget) {
+    if ((win = least_recently_viewed(wm, 1))) {
+      win->mipmaps = 0;
+      release_mips(wm, win);
+      update_bytes(wm, win);
+    } else if ((win = least_recently_viewed(wm, 0))) {
+      win->evicted = 1;
+      suspend_window(wm, win);
+      wm->gl_pending = 1;
+    } else {
+      break;
+    }
+    wm->evictions++;
+  }
+}
+
+static void
+switch_workspace(riftwm_t *wm, int workspace)
+{
+  riftwin_t *win;
+
+  if (workspace == wm->workspace) {
+    return;
+  }
+
+  // Windows of the new workspace are bound again by the next update
+  for (win = wm->windows; win; win = win->next) {
+    if (win->workspace == wm->workspace) {
+      suspend_window(wm, win);
+    } else if (win->workspace == workspace && win->mapped) {
+      win->dirty = 1;
+    }
+  }
+
+  wm->workspace = workspace;
+  wm->gl_pending = 1;
+}
+
+static void
+move_to_workspace(riftwm_t *wm, riftwin_t *win, int workspace)
+{
+  if (workspace == win->workspace || !win->mapped) {
+    return;
+  }
+
+  // Give up the cell here and take the best free one there
+  layout_remove(win_layout(wm, win), win);
+  win->workspace = workspace;
+  layout_place(win_layout(wm, win), win, 0);
+
+  // Windows leaving the current workspace keep only their thumbnail
+  if (workspace != wm->workspace) {
+    suspend_window(wm, win);
+  } else {
+    win->dirty = 1;
+  }
+  wm->gl_pending = 1;
+}
+
+static void
+overview_matrix(mat4x4 M, vec3 center, int workspace)
+{
+  float a;
+
+  // Miniatures of the workspaces on an arc in front of the user
+  a = (workspace - (RIFTWM_WORKSPACES - 1) * 0.5f) * 0.6f;
+  mat4x4_translate(M, center[0] + 4.0f * sinf(a), center[1] - 1.0f,
+                   center[2] - 4.0f * cosf(a));
+  mat4x4_scale_aniso(M, M, RIFTWM_OVERVIEW_SCALE, RIFTWM_OVERVIEW_SCALE,
+                     RIFTWM_OVERVIEW_SCALE);
+  mat4x4_translate_in_place(M, -center[0], -center[1], -center[2]);
+}
+
+static void
+simulate(riftwm_t *wm, float dt)
+{
+  renderer_t *r = wm->renderer;
+  vec3 move_dir = { 0.0f, 0.0f, 0.0f };
+  int i;
+
+  memcpy(wm->sim_prev, wm->sim_pos, sizeof(vec3));
+
+  // Walk along the heading at a fixed speed, whatever the loop rate
+  if (wm->key_up) {
+    move_dir[0] += sin(r->rot_y) * cos(r->rot_x);
+    move_dir[2] += cos(r->rot_y) * cos(r->rot_x);
+  }
+
+  if (wm->key_down) {
+    move_dir[0] -= sin(r->rot_y) * cos(r->rot_x);
+    move_dir[2] -= cos(r->rot_y) * cos(r->rot_x);
+  }
+
+  if (wm->key_left) {
+    move_dir[0] += sin(r->rot_y + M_PI / 2.0f) * cos(r->rot_x);
+    move_dir[2] += cos(r->rot_y + M_PI / 2.0f) * cos(r->rot_x);
+  }
+
+  if (wm->key_right) {
+    move_dir[0] += sin(r->rot_y - M_PI / 2.0f) * cos(r->rot_x);
+    move_dir[2] += cos(r->rot_y - M_PI / 2.0f) * cos(r->rot_x);
+  }
+
+  if (vec3_len(move_dir) >= 0.1f) {
+    vec3_norm(move_dir, move_dir);
+    vec3_scale(move_dir, move_dir, RIFTWM_MOVE_SPEED * dt);
+    vec3_add(wm->sim_pos, wm->sim_pos, move_dir);
+  }
+
+  // Head tracking is filtered over a fixed number of steps
+  kinect_step(wm->kinect, wm->sim_pos);
+
+  // Move windows that are changing cells
+  for (i = 0; i < RIFTWM_WORKSPACES; ++i) {
+    layout_animate(&wm->workspaces[i].layout, dt);
+  }
+}
+
+static riftwin_t *
+find_parent(riftwm_t *wm, riftwin_t *win)
+{
+  riftwin_t *parent;
+
+  // The window the client names, else the newest one in a cell
+  if (win->transient_for &&
+      (parent = find_window(wm, win->transient_for)) &&
+      parent != win && parent->mapped && !parent->unplaced)
+  {
+    return parent;
+  }
+  for (parent = wm->windows; parent; parent = parent->next) {
+    if (parent != win && parent->mapped && parent->cell >= 0 &&
+        parent->workspace == wm->workspace)
+    {
+      return parent;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+place_windows(riftwm_t *wm, int animate)
+{
+  riftwin_t *win, *parent;
+  ewmh_type_t type;
+  vec3 value = { 0.0f, 0.0f, 0.0f };
+
+  ewmh_fetch(&wm->ewmh, wm->windows);
+
+  // Dialogs sit in front of their parent and menus keep their offset from
+  // it, docks go below the front cell and the rest get cells
+  for (win = wm->windows; win; win = win->next) {
+    if (!win->unplaced) {
+      continue;
+    }
+    win->unplaced = 0;
+
+    type = ewmh_type(win);
+    value[0] = (float)type;
+    trace_emit(&wm->trace, TRACE_MAIN, TRACE_PLACE, (uint32_t)win->window,
+               value);
+    if (type == EWMH_TYPE_DOCK) {
+      layout_attach(win_layout(wm, win), win, NULL, LAYOUT_ATTACH_DOCK);
+    } else if (type != EWMH_TYPE_NORMAL && (parent = find_parent(wm, win))) {
+      win->workspace = parent->workspace;
+      layout_attach(win_layout(wm, win), win, parent,
+                    type == EWMH_TYPE_MENU ? LAYOUT_ATTACH_OFFSET :
+                                             LAYOUT_ATTACH_CENTER);
+    } else {
+      layout_place(win_layout(wm, win), win, animate);
+    }
+  }
 }
 
 static void
 scan_windows(riftwm_t *wm)
 {
   Window root, parent, *children;
-  XWindowAttributes attr;
+  xcb_get_window_attributes_cookie_t *cookies;
+  xcb_get_window_attributes_reply_t *attr;
   unsigned count, i;
   riftwin_t * win;
+  handoff_win_t *hw;
 
   XGrabServer(wm->dpy);
 
   if (XQueryTree(wm->dpy, wm->root, &root, &parent, &children, &count)) {
+    // All the attribute requests go out before the first reply is read:
+    // one round trip under the grab instead of one per window
+    assert((cookies = (xcb_get_window_attributes_cookie_t*)malloc(
+            sizeof(xcb_get_window_attributes_cookie_t) * (count + 1))));
+    for (i = 0; i < count; ++i) {
+      cookies[i] = xcb_get_window_attributes(wm->ewmh.conn, children[i]);
+    }
+
     for (i = 0; i < count; ++i) {
+      if (!(attr = xcb_get_window_attributes_reply(wm->ewmh.conn, cookies[i],
+                                                   NULL)))
+      {
+        continue;
+      }
       win = add_window(wm, children[i]);
-      if (!XGetWindowAttributes(wm->dpy, win->window, &attr)) {
-        riftwm_error(wm, "Cannot retrieve window attributes");
+
+      // The map state is queried again: clients may have unmapped windows
+      // while the new instance was starting
+      win->mapped = attr->map_state == XCB_MAP_STATE_VIEWABLE;
+      free(attr);
+
+      // Windows known to the previous instance keep their placement
+      if ((hw = handoff_find_window(wm->handoff, win->window))) {
+        win->cell = hw->cell;
+        win->workspace = hw->workspace;
+        win->focused = hw->focused;
       }
 
-      win->mapped = attr.map_state == IsViewable;
+      win->unplaced = win->mapped;
     }
 
+    free(cookies);
     if (children) {
       XFree(children);
     }
   }
 
+  // The properties of all the windows are read in a single batch
+  place_windows(wm, 0);
   XUngrabServer(wm->dpy);
 }
 
@@ -227,7 +1044,10 @@ scan_windows(riftwm_t *wm)
 static void
 evt_key_press(riftwm_t *wm, XEvent *evt)
 {
+  riftwin_t *win;
   KeySym keysym;
+  Window focus;
+  int revert;
 
   keysym = XLookupKeysym(&evt->xkey, 0);
   switch (keysym) {
@@ -246,13 +1066,38 @@ evt_key_press(riftwm_t *wm, XEvent *evt)
       system("subl &");
       break;
     }
+    case XK_F4:
+    {
+      wm->overview = !wm->overview;
+      break;
+    }
+    case XK_F5: case XK_F6: case XK_F7: case XK_F8:
+    {
+      // With shift, the window with the input focus goes there instead
+      if (evt->xkey.state & ShiftMask) {
+        XGetInputFocus(wm->dpy, &focus, &revert);
+        if ((win = find_window(wm, focus))) {
+          move_to_workspace(wm, win, keysym - XK_F5);
+        }
+      } else {
+        switch_workspace(wm, keysym - XK_F5);
+      }
+      break;
+    }
+    case XK_F9:
+    {
+      if (wm->trace.file) {
+        wm->trace.enabled = !wm->trace.enabled;
+      }
+      break;
+    }
     case XK_w: wm->key_up    = 1; break;
     case XK_s: wm->key_down  = 1; break;
     case XK_a: wm->key_left  = 1; break;
     case XK_d: wm->key_right = 1; break;
   }
 
-  riftwin_t *win = wm->windows;
+  win = wm->windows;
   while (win) {
     if (win->focused && win->mapped) {
       evt->xkey.window = win->window;
@@ -284,7 +1129,7 @@ evt_motion_notify(riftwm_t *wm, XEvent *evt)
   int dx = me->x - (wm->screen_width >> 1);
   int dy = me->y - (wm->screen_height >> 1);
 
-  if ((dx != 0 || dy != 0) && !wm->has_rift) {
+  if ((dx != 0 || dy != 0) && wm->mono) {
     wm->renderer->rot_x += dy / 100.0f;
     wm->renderer->rot_y += dx / 100.0f;
 
@@ -352,8 +1197,10 @@ evt_map_notify(riftwm_t *wm, XEvent *evt)
   win = add_window(wm, evt->xmap.window);
   win->mapped = 1;
   win->dirty = 1;
+  win->unplaced = 1;
 
   XSetInputFocus(wm->dpy, win->window, RevertToPointerRoot, CurrentTime);
+  focus_window(wm, win);
 
   fe.type = FocusIn;
   fe.send_event = True;
@@ -385,6 +1232,68 @@ evt_configure_notify(riftwm_t *wm, XEvent *evt)
   win->dirty = 1;
 }
 
+static void
+evt_property_notify(riftwm_t *wm, XEvent *evt)
+{
+  riftwin_t *win;
+
+  if ((win = find_window(wm, evt->xproperty.window))) {
+    ewmh_invalidate(&wm->ewmh, win, evt->xproperty.atom);
+  }
+}
+
+static void
+evt_focus_in(riftwm_t *wm, XEvent *evt)
+{
+  riftwin_t *win;
+
+  // Clients may also take the focus themselves
+  if (evt->xfocus.detail != NotifyPointer &&
+      (win = find_window(wm, evt->xfocus.window)))
+  {
+    focus_window(wm, win);
+  }
+}
+
+static void
+evt_damage_notify(riftwm_t *wm, XEvent *evt)
+{
+  XDamageNotifyEvent *de = (XDamageNotifyEvent*)evt;
+  riftwin_t *win;
+
+  if ((win = find_window(wm, de->drawable))) {
+    box_union(win->damage_box, de->area.x, de->area.y,
+              de->area.x + de->area.width, de->area.y + de->area.height);
+    win->damaged = 1;
+  }
+
+  XDamageSubtract(wm->dpy, de->damage, None, None);
+}
+
+static int
+evt_error(Display *dpy, XErrorEvent *evt)
+{
+  char msg[128];
+
+  // Windows can vanish at any time: do not let that kill the wm
+  if (evt->error_code == BadWindow || evt->error_code == BadDrawable ||
+      evt->error_code == BadMatch ||
+      evt->error_code == wm.damage_error + BadDamage)
+  {
+    if (wm.verbose) {
+      XGetErrorText(dpy, evt->error_code, msg, sizeof(msg));
+      fprintf(stderr, "X error: %s (request %d)\n", msg, evt->request_code);
+    }
+    return 0;
+  }
+
+  // Anything else is a bug or another wm in the way, checked by init
+  XGetErrorText(dpy, evt->error_code, msg, sizeof(msg));
+  fprintf(stderr, "X error: %s (request %d)\n", msg, evt->request_code);
+  wm.x_errors++;
+  return 0;
+}
+
 struct
 {
   const char *name;
@@ -399,7 +1308,7 @@ handlers[LASTEvent] =
   [MotionNotify]     = { "MotionNotify",      evt_motion_notify     },
   [EnterNotify]      = { "EnterNotify",       NULL },
   [LeaveNotify]      = { "LeaveNotify",       NULL },
-  [FocusIn]          = { "FocusIn",           NULL },
+  [FocusIn]          = { "FocusIn",           evt_focus_in          },
   [FocusOut]         = { "FocusOut",          NULL },
   [KeymapNotify]     = { "KeymapNotify",      NULL },
   [Expose]           = { "Expose",            NULL },
@@ -418,7 +1327,7 @@ handlers[LASTEvent] =
   [ResizeRequest]    = { "ResizeRequest",     NULL },
   [CirculateNotify]  = { "CirculateNotify",   NULL },
   [CirculateRequest] = { "CirculateRequest",  NULL },
-  [PropertyNotify]   = { "PropertyNotify",    NULL },
+  [PropertyNotify]   = { "PropertyNotify",    evt_property_notify   },
   [SelectionClear]   = { "SelectionClear",    NULL },
   [SelectionRequest] = { "SelectionRequest",  NULL },
   [SelectionNotify]  = { "SelectionNotify",   NULL },
@@ -436,14 +1345,36 @@ riftwm_init(riftwm_t *wm)
 {
   int event_base, error_base;
   int major, minor, i;
+  float max_aniso;
+  const char *glx_exts;
+  vec3 center;
 
   ilInit();
 
-  // Init Xlib
+  // Start recording before anything worth timing happens
+  if (wm->trace_path && !trace_open(&wm->trace, wm->trace_path)) {
+    riftwm_error(wm, "Cannot open trace %s", wm->trace_path);
+  }
+
+  // State handed over by riftwm_restart
+  if (wm->handoff_fd >= 0 && !(wm->handoff = handoff_load(wm->handoff_fd))) {
+    fprintf(stderr, "Cannot load restart state, starting afresh\n");
+  }
+  if (wm->handoff) {
+    wm->restarted_at = wm->handoff->saved_at;
+  }
+
+  // Init Xlib, shared with the render thread
+  if (!XInitThreads()) {
+    riftwm_error(wm, "Cannot initialise Xlib threads");
+  }
+
   if (!(wm->dpy = XOpenDisplay(NULL))) {
     riftwm_error(wm, "Cannot open display");
   }
 
+  XSetErrorHandler(evt_error);
+
   if (!(wm->screen = XScreenCount(wm->dpy))) {
     riftwm_error(wm, "Cannot get screen count");
   }
@@ -458,6 +1389,10 @@ riftwm_init(riftwm_t *wm)
     riftwm_error(wm, "XComposite unavailable");
   }
 
+  if (!XDamageQueryExtension(wm->dpy, &wm->damage_event, &wm->damage_error)) {
+    riftwm_error(wm, "XDamage unavailable");
+  }
+
   // Select the oculus screen
   while (--wm->screen >= 0) {
     wm->screen_width = XDisplayWidth(wm->dpy, wm->screen);
@@ -478,6 +1413,9 @@ riftwm_init(riftwm_t *wm)
   if (!(wm->overlay = XCompositeGetOverlayWindow(wm->dpy, wm->root))) {
     riftwm_error(wm, "Cannot get overlay window");
   }
+  if (!ewmh_init(&wm->ewmh, wm->dpy, wm->root, wm->overlay)) {
+    riftwm_error(wm, "Cannot intern atoms");
+  }
 
   // Retrieve all fb configs
   const int FBATTR[] =
@@ -530,18 +1468,55 @@ riftwm_init(riftwm_t *wm)
     riftwm_error(wm, "Cannot create OpenGL context");
   }
 
+  // The render thread shares textures, buffers and programs with it
+  if (!(wm->render_context = glXCreateContext(wm->dpy, vi, wm->context,
+                                              GL_TRUE)))
+  {
+    XFree(vi);
+    riftwm_error(wm, "Cannot create render context");
+  }
+
+  // Mirror of the left eye. Children of the overlay are not redirected,
+  // so it shows up on the monitor the geometry places it on
+  if (wm->spectator_width > 0 && wm->spectator_height > 0) {
+    XSetWindowAttributes swa;
+
+    wm->spectator_cmap = XCreateColormap(wm->dpy, wm->root, vi->visual,
+                                         AllocNone);
+    swa.colormap = wm->spectator_cmap;
+    swa.border_pixel = 0;
+    wm->spectator = XCreateWindow(wm->dpy, wm->overlay, wm->spectator_x,
+                                  wm->spectator_y, wm->spectator_width,
+                                  wm->spectator_height, 0, vi->depth,
+                                  InputOutput, vi->visual,
+                                  CWColormap | CWBorderPixel, &swa);
+    XMapWindow(wm->dpy, wm->spectator);
+
+    // Stays bound to the mirror in its own thread
+    if (!(wm->spectator_context = glXCreateContext(wm->dpy, vi, wm->context,
+                                                   GL_TRUE)))
+    {
+      XFree(vi);
+      riftwm_error(wm, "Cannot create spectator context");
+    }
+  }
+
   XFree(vi);
   if (!glXMakeCurrent(wm->dpy, wm->overlay, wm->context)) {
     riftwm_error(wm, "Cannot bind OpenGL context");
   }
 
-  // Link GLX routines
-  if (!(wm->glXBindTexImageEXT = (glXBindTexImageEXTProc)
+  // Link GLX routines. Some stacks hand out the entry points without
+  // supporting the extension, so the extension string is checked as well
+  glx_exts = glXQueryExtensionsString(wm->dpy, wm->screen);
+  if (wm->streaming || !glx_exts ||
+      !strstr(glx_exts, "GLX_EXT_texture_from_pixmap") ||
+      !(wm->glXBindTexImageEXT = (glXBindTexImageEXTProc)
           glXGetProcAddress("glXBindTexImageEXT")) ||
       !(wm->glXReleaseTexImageEXT = (glXReleaseTexImageEXTProc)
           glXGetProcAddress("glXReleaseTexImageEXT")))
   {
-    riftwm_error(wm, "Cannot bind GLX_EXT_texture_from_pixmap");
+    wm->streaming = 1;
   }
 
   // Init GLEW
@@ -549,28 +1524,94 @@ riftwm_init(riftwm_t *wm)
     riftwm_error(wm, "Cannot initialise GLEW");
   }
 
-  // Init the oculus
-  if ((wm->rift_ctx = ohmd_ctx_create()) &&
-      (wm->has_rift = ohmd_ctx_probe(wm->rift_ctx)) > 0 &&
-      (wm->rift_dev = ohmd_list_open_device(wm->rift_ctx, 0)))
-  {
-    fprintf(stderr, "Oculus available!\n");
+  // Without texture_from_pixmap, contents are copied through MIT-SHM
+  if (wm->streaming) {
+    if (!upload_init(&wm->upload, wm->dpy)) {
+      riftwm_error(wm, "Cannot bind GLX_EXT_texture_from_pixmap or MIT-SHM");
+    }
+    fprintf(stderr, "Streaming window contents through MIT-SHM%s\n",
+            wm->upload.persistent ? " and persistent buffers" : "");
+  }
+
+  if (wm->anisotropy > 1.0f) {
+    if (GLEW_EXT_texture_filter_anisotropic) {
+      glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_aniso);
+      wm->anisotropy = wm->anisotropy < max_aniso ? wm->anisotropy : max_aniso;
+    } else {
+      fprintf(stderr, "Anisotropic filtering unavailable\n");
+      wm->anisotropy = 0.0f;
+    }
+  }
+
+  // Init the oculus. A restart without a headset before skips the USB
+  // probe: plugging one in takes a full start.
+  if (wm->handoff && wm->handoff->rift_devices <= 0) {
+    fprintf(stderr, "Oculus unavailable before restart\n");
   } else {
-    fprintf(stderr, "Oculus unavailable\n");
+    if ((wm->rift_ctx = ohmd_ctx_create()) &&
+        (wm->has_rift = ohmd_ctx_probe(wm->rift_ctx)) > 0 &&
+        (wm->rift_dev = ohmd_list_open_device(wm->rift_ctx, 0)))
+    {
+      fprintf(stderr, "Oculus available!\n");
+    } else {
+      fprintf(stderr, "Oculus unavailable\n");
+    }
+
+    wm->has_rift -= 1;
   }
 
-  wm->has_rift -= 1;
+  // Without a headset the scene is drawn once, straight to the overlay
+  if (wm->has_rift <= 0 || !wm->rift_dev) {
+    wm->mono = 1;
+  }
+  if (wm->mono) {
+    fprintf(stderr, "Mono desktop mode\n");
+    if (wm->spectator) {
+      fprintf(stderr, "Spectator unavailable in mono mode\n");
+      XDestroyWindow(wm->dpy, wm->spectator);
+      wm->spectator = 0;
+    }
+  }
 
   // Init the renderer
   if (!(wm->renderer = renderer_init(wm))) {
     riftwm_error(wm, "Cannot initialise the renderer");
   }
 
+  // Windows are laid out around the starting point of the user
+  vec3_scale(center, wm->renderer->pos, -1.0f);
+  for (i = 0; i < RIFTWM_WORKSPACES; ++i) {
+    layout_init(&wm->workspaces[i].layout, wm->layout_shape, center);
+    overview_matrix(wm->workspaces[i].overview, center, i);
+  }
+
+  // Shared texture for small windows
+  atlas_init(&wm->atlas, ATLAS_SIZE);
+  wm->texture_bytes += (size_t)ATLAS_SIZE * ATLAS_SIZE * 4;
+
+  if (wm->handoff) {
+    memcpy(wm->renderer->pos, wm->handoff->pos, sizeof(vec3));
+    memcpy(wm->renderer->dir, wm->handoff->dir, sizeof(vec3));
+    memcpy(wm->renderer->origin, wm->handoff->origin, sizeof(float) * 3);
+    wm->renderer->rot_x = wm->handoff->rot_x;
+    wm->renderer->rot_y = wm->handoff->rot_y;
+    wm->renderer->has_origin = wm->handoff->has_origin;
+    if (wm->handoff->workspace >= 0 &&
+        wm->handoff->workspace < RIFTWM_WORKSPACES)
+    {
+      wm->workspace = wm->handoff->workspace;
+    }
+  }
+
   // Init the kinect
   if (!(wm->kinect = kinect_init(wm))) {
     riftwm_error(wm, "Cannot initialise kinect");
   }
 
+  if (wm->handoff) {
+    kinect_calibrate(wm->kinect, wm->handoff->shift);
+  }
+
   XCompositeRedirectSubwindows(wm->dpy, wm->root, CompositeRedirectAutomatic);
 
   // Capture events
@@ -580,14 +1621,18 @@ riftwm_init(riftwm_t *wm)
                                   KeyReleaseMask);
 
   XSync(wm->dpy, False);
+  if (wm->x_errors) {
+    riftwm_error(wm, "Cannot manage the screen, is another window manager "
+                 "or compositor running?");
+  }
 }
 
 void
 riftwm_restart(riftwm_t * wm)
 {
   struct stat st;
-  int length, read;
-  char *path, *suffix;
+  int length, read, fd, argc, i, n;
+  char *path, *suffix, **argv, arg[32];
 
   if (lstat("/proc/self/exe", &st) == -1) {
     riftwm_error(wm, "Cannot stat /proc/self/exe");
@@ -613,8 +1658,32 @@ riftwm_restart(riftwm_t * wm)
     *suffix = '\0';
   }
 
+  // Hand the state over through a memfd inherited across exec
+  if ((fd = handoff_save(wm)) < 0) {
+    fprintf(stderr, "Cannot save restart state\n");
+  }
+
+  for (argc = 0; wm->argv && wm->argv[argc]; ++argc);
+  assert((argv = (char**)malloc(sizeof(char*) * (argc + 2))));
+
+  n = 0;
+  argv[n++] = path;
+  for (i = 1; i < argc; ++i) {
+    if (strncmp(wm->argv[i], "--handoff", 9)) {
+      argv[n++] = wm->argv[i];
+    }
+  }
+  if (fd >= 0) {
+    snprintf(arg, sizeof(arg), "--handoff=%d", fd);
+    argv[n++] = arg;
+  }
+  argv[n] = NULL;
+
+  // The new instance starts its own trace
+  trace_close(&wm->trace);
+
   fprintf(stderr, "Restarting %s\n", path);
-  if (execv(path, NULL) < 0) {
+  if (execv(path, argv) < 0) {
     riftwm_error(wm, "Restart failed (errno: %d)", errno);
   }
 }
@@ -622,80 +1691,119 @@ riftwm_restart(riftwm_t * wm)
 void
 riftwm_run(riftwm_t *wm)
 {
+  struct pollfd pfd;
   XEvent evt;
+  double now, last;
+  float alpha;
+  vec3 usage;
+  quat q;
+  int i;
 
   XGrabPointer(wm->dpy, wm->root, True, PointerMotionMask,
                GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
   XGrabKeyboard(wm->dpy, wm->root, True, GrabModeAsync,
                 GrabModeAsync, CurrentTime);
 
+  // Scene rendering and scan-out happen on the render thread
+  update_windows(wm);
+  renderer_start(wm->renderer);
+  if (wm->restarted_at > 0.0) {
+    fprintf(stderr, "Resumed in %.0fms\n",
+            (riftwm_time() - wm->restarted_at) * 1000.0);
+  }
+
+  memcpy(wm->sim_pos, wm->renderer->pos, sizeof(vec3));
+  memcpy(wm->sim_prev, wm->sim_pos, sizeof(vec3));
+  wm->sim_time = 0.0;
+  last = riftwm_time();
   wm->running = 1;
   while (wm->running) {
     // Process events
+    trace_begin(&wm->trace, TRACE_MAIN, TRACE_EVENTS);
     while (XPending(wm->dpy) > 0) {
       XNextEvent(wm->dpy, &evt);
-      if (evt.type < LASTEvent) {
-        if (wm->verbose) {
-          fprintf(stderr, "Event %s\n", handlers[evt.type].name);
-        }
+      trace_emit(&wm->trace, TRACE_MAIN, TRACE_XEVENT, evt.type, NULL);
+      if (evt.type == wm->damage_event + XDamageNotify) {
+        evt_damage_notify(wm, &evt);
+      } else if (evt.type < LASTEvent) {
         if (handlers[evt.type].func) {
           handlers[evt.type].func(wm, &evt);
         }
       }
     }
+    place_windows(wm, 1);
+    trace_end(&wm->trace, TRACE_MAIN, TRACE_EVENTS);
 
-    // Update position if not using rift
-    ohmd_ctx_update(wm->rift_ctx);
-    float q[4];
-    ohmd_device_getf(wm->rift_dev, OHMD_ROTATION_QUAT, q);
-    q[0] = 0.0f;
-    q[2] = 0.0f;
-    float l = sqrtf(q[1] * q[1] + q[3] * q[3]);
-    q[1] /= l;
-    q[3] /= l;
-    wm->renderer->rot_y = 2 * acos(q[1]);
-    vec3 move_dir = { 0.0f, 0.0f, 0.0f };
-
-    if (wm->key_up)
-    {
-      move_dir[0] += sin(wm->renderer->rot_y) * cos(wm->renderer->rot_x);
-      move_dir[2] += cos(wm->renderer->rot_y) * cos(wm->renderer->rot_x);
+    // Errors on the render thread are reported here
+    if (renderer_failed(wm->renderer)) {
+      longjmp(wm->err_jmp, 1);
     }
 
-    if (wm->key_down)
-    {
-      move_dir[0] -= sin(wm->renderer->rot_y) * cos(wm->renderer->rot_x);
-      move_dir[2] -= cos(wm->renderer->rot_y) * cos(wm->renderer->rot_x);
+    // Update heading from the latest head orientation, or from the mouse
+    if (wm->mono) {
+      q[0] = 0.0f;
+      q[1] = sinf(wm->renderer->rot_y * 0.5f);
+      q[2] = 0.0f;
+      q[3] = cosf(wm->renderer->rot_y * 0.5f);
+    } else {
+      renderer_orientation(wm->renderer, q);
+      q[0] = 0.0f;
+      q[2] = 0.0f;
+      float l = sqrtf(q[1] * q[1] + q[3] * q[3]);
+      q[1] /= l;
+      q[3] /= l;
+      wm->renderer->rot_y = 2 * acos(q[1]);
     }
 
-    if (wm->key_left)
-    {
-      move_dir[0] += sin(wm->renderer->rot_y + M_PI / 2.0f) * cos(wm->renderer->rot_x);
-      move_dir[2] += cos(wm->renderer->rot_y + M_PI / 2.0f) * cos(wm->renderer->rot_x);
+    // Retrieve kinect data
+    kinect_update(wm->kinect);
+    if (wm->passthrough) {
+      update_depth(wm);
     }
 
-    if (wm->key_right)
-    {
-      move_dir[0] += sin(wm->renderer->rot_y - M_PI / 2.0f) * cos(wm->renderer->rot_x);
-      move_dir[2] += cos(wm->renderer->rot_y - M_PI / 2.0f) * cos(wm->renderer->rot_x);
+    // Advance the simulation in fixed steps. If the loop falls behind,
+    // the time it cannot catch up on is dropped
+    now = riftwm_time();
+    wm->sim_time += now - last;
+    last = now;
+    if (wm->sim_time > RIFTWM_SIM_STEP * RIFTWM_SIM_MAX_STEPS) {
+      wm->sim_time = RIFTWM_SIM_STEP * RIFTWM_SIM_MAX_STEPS;
     }
-
-    if (vec3_len(move_dir) >= 0.1f) {
-      vec3_norm(move_dir, move_dir);
-      vec3_scale(move_dir, move_dir, 0.3f);
-      vec3_add(wm->renderer->pos, wm->renderer->pos, move_dir);
+    trace_begin(&wm->trace, TRACE_MAIN, TRACE_SIMULATE);
+    while (wm->sim_time >= RIFTWM_SIM_STEP) {
+      simulate(wm, RIFTWM_SIM_STEP);
+      wm->sim_time -= RIFTWM_SIM_STEP;
     }
+    trace_end(&wm->trace, TRACE_MAIN, TRACE_SIMULATE);
 
-    // Retrieve kinect data
-    kinect_update(wm->kinect);
+    // Place the camera between the last two steps
+    alpha = wm->sim_time / RIFTWM_SIM_STEP;
+    for (i = 0; i < 3; ++i) {
+      wm->renderer->pos[i] = wm->sim_prev[i] +
+                             (wm->sim_pos[i] - wm->sim_prev[i]) * alpha;
+    }
 
-    // Update window attributes
+    // Keep window textures within the memory budget
+    trace_begin(&wm->trace, TRACE_MAIN, TRACE_RESIDENCY);
+    update_residency(wm, q);
+    trace_end(&wm->trace, TRACE_MAIN, TRACE_RESIDENCY);
+    usage[0] = wm->texture_bytes / 1048576.0f;
+    usage[1] = wm->texture_budget / 1048576.0f;
+    usage[2] = (float)wm->evictions;
+    trace_emit(&wm->trace, TRACE_MAIN, TRACE_TEXTURES, 0, usage);
+
+    // Update window textures and hand a snapshot to the render thread
+    trace_begin(&wm->trace, TRACE_MAIN, TRACE_UPDATE);
     update_windows(wm);
+    trace_end(&wm->trace, TRACE_MAIN, TRACE_UPDATE);
     XFlush(wm->dpy);
 
-    // Display the windows
-    renderer_frame(wm->renderer);
-    glXSwapBuffers(wm->dpy, wm->overlay);
+    // Sleep until the next event arrives or the next tick is due
+    if (!XPending(wm->dpy)) {
+      pfd.fd = ConnectionNumber(wm->dpy);
+      pfd.events = POLLIN;
+      poll(&pfd, 1, RIFTWM_TICK);
+    }
   }
 }
 
@@ -703,6 +1811,45 @@ void
 riftwm_destroy(riftwm_t *wm)
 {
   riftwin_t *win, *tmp;
+  int i;
+
+  if (wm->renderer) {
+    renderer_stop(wm->renderer);
+  }
+
+  // Nothing needs to move into the cells freed at shutdown
+  for (i = 0; i < RIFTWM_WORKSPACES; ++i) {
+    layout_destroy(&wm->workspaces[i].layout);
+  }
+
+  win = wm->windows;
+  while (win) {
+    tmp = win;
+    win = win->next;
+    free_window(wm, tmp);
+  }
+  wm->windows = NULL;
+
+  if (wm->copy_fbo[0]) {
+    glDeleteFramebuffers(2, wm->copy_fbo);
+    wm->copy_fbo[0] = wm->copy_fbo[1] = 0;
+  }
+  if (wm->mip_query) {
+    glDeleteQueries(1, &wm->mip_query);
+    wm->mip_query = 0;
+  }
+
+  atlas_destroy(&wm->atlas);
+  trace_close(&wm->trace);
+  if (wm->streaming) {
+    upload_destroy(&wm->upload);
+  }
+  free(wm->view_bounds);
+  free(wm->view_visible);
+  free(wm->refresh);
+  wm->view_bounds = NULL;
+  wm->view_visible = NULL;
+  wm->refresh = NULL;
 
   if (wm->renderer) {
     renderer_destroy(wm->renderer);
@@ -719,11 +1866,14 @@ riftwm_destroy(riftwm_t *wm)
     wm->rift_ctx = NULL;
   }
 
-  win = wm->windows;
-  while (win) {
-    tmp = win;
-    win = win->next;
-    free_window(wm, tmp);
+  if (wm->render_context) {
+    glXDestroyContext(wm->dpy, wm->render_context);
+    wm->render_context = NULL;
+  }
+
+  if (wm->spectator_context) {
+    glXDestroyContext(wm->dpy, wm->spectator_context);
+    wm->spectator_context = NULL;
   }
 
   if (wm->context) {
@@ -732,11 +1882,27 @@ riftwm_destroy(riftwm_t *wm)
     wm->context = NULL;
   }
 
+  if (wm->spectator) {
+    XDestroyWindow(wm->dpy, wm->spectator);
+    wm->spectator = 0;
+  }
+
+  if (wm->spectator_cmap) {
+    XFreeColormap(wm->dpy, wm->spectator_cmap);
+    wm->spectator_cmap = 0;
+  }
+
+  ewmh_destroy(&wm->ewmh);
   if (wm->overlay) {
     XCompositeReleaseOverlayWindow(wm->dpy, wm->overlay);
     wm->overlay = 0;
   }
 
+  if (wm->handoff) {
+    handoff_free(wm->handoff);
+    wm->handoff = NULL;
+  }
+
   if (wm->err_msg) {
     free(wm->err_msg);
     wm->err_msg = NULL;
@@ -782,19 +1948,42 @@ riftwm_error(riftwm_t *wm, const char *fmt, ...)
     wm->err_msg = tmp;
   }
 
+  // Errors on the render thread only unwind that thread
+  if (wm->renderer && wm->renderer->running &&
+      pthread_equal(pthread_self(), wm->renderer->thread))
+  {
+    longjmp(wm->renderer->err_jmp, 1);
+  }
+
   longjmp(wm->err_jmp, 1);
 }
 
+double
+riftwm_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 // -----------------------------------------------------------------------------
 // riftwin api
 // -----------------------------------------------------------------------------
-void
+int
 riftwin_update(riftwm_t *wm, riftwin_t *win)
 {
-  if (win->dirty && win->dirty) {
+  int updated = 0;
+
+  // Damage is left to the refresh scheduler in update_windows
+  if (win->dirty) {
     create_texture(wm, win);
     win->dirty = 0;
+    updated = 1;
+    update_bytes(wm, win);
   }
+
+  return updated;
 }
 // -----------------------------------------------------------------------------
 // Entry point
@@ -806,7 +1995,24 @@ usage()
   puts("Usage:");
   puts("\triftwm [options]");
   puts("Options:");
-  puts("\t--verbose: Print more messages\n");
+  puts("\t--verbose: Print more messages");
+  puts("\t--layout=cylinder|sphere: Arrangement of the windows");
+  puts("\t--texture-budget=MB: Memory for window textures, unlimited if 0");
+  puts("\t--anisotropy=N: Anisotropic filtering on top of the mips");
+  puts("\t--stream: Upload window contents instead of texture_from_pixmap");
+  puts("\t--trace=file: Record events and frame timings, F9 toggles");
+  puts("\t--shader-reload: Load shaders from shader/ and reload on change");
+  puts("\t--mono: Single undistorted view, even with a headset");
+  puts("\t--spectator=WxH+X+Y: Mirror the left eye into a window");
+  puts("\t--spectator-rate=Hz: Refresh rate of the mirror");
+  puts("\t--capture=file.y4m: Record the headset output");
+  puts("\t--passthrough: Show the kinect depth as a point cloud");
+  puts("\t--layers: Sample near windows in the distortion pass");
+  puts("\t--eye-scale=F: Resolution of the eye buffers, 1 by default");
+  puts("\t--foveate: Shade the periphery of the eyes at lower resolution");
+  puts("\t--no-batch: Draw windows one by one, even with multi-draw");
+  puts("\t--trace-json=file: Convert a recorded trace to Chrome JSON");
+  puts("\t--handoff=fd: Resume from the state saved by a restart\n");
 }
 
 int
@@ -817,11 +2023,32 @@ main(int argc, char **argv)
   {
     { "help",    no_argument, NULL,            0 },
     { "verbose", no_argument, &wm.verbose,     1 },
+    { "handoff", required_argument, NULL,      'H' },
+    { "layout",  required_argument, NULL,      'L' },
+    { "texture-budget", required_argument, NULL, 'B' },
+    { "anisotropy", required_argument, NULL,   'A' },
+    { "stream",  no_argument, &wm.streaming,   1 },
+    { "trace",   required_argument, NULL,      'T' },
+    { "trace-json", required_argument, NULL,   'J' },
+    { "shader-reload", no_argument, &wm.shader_reload, 1 },
+    { "mono",    no_argument, &wm.mono,        1 },
+    { "spectator", required_argument, NULL,    'S' },
+    { "spectator-rate", required_argument, NULL, 'R' },
+    { "capture", required_argument, NULL,      'C' },
+    { "passthrough", no_argument, &wm.passthrough, 1 },
+    { "layers",  no_argument, &wm.layers,      1 },
+    { "eye-scale", required_argument, NULL,    'E' },
+    { "foveate", no_argument, &wm.foveate,     1 },
+    { "no-batch", no_argument, &wm.no_batch,   1 },
     { NULL,      0,           NULL,            0 }
   };
 
   // Parse command line arguments
   memset(&wm, 0, sizeof(wm));
+  wm.argv = argv;
+  wm.handoff_fd = -1;
+  wm.spectator_rate = RIFTWM_SPECTATOR_RATE;
+  wm.eye_scale = 1.0f;
   while ((c = getopt_long(argc, argv, "rh", options, &opt_idx)) != -1) {
     switch (c) {
       // A flag was set
@@ -830,6 +2057,77 @@ main(int argc, char **argv)
           break;
         }
         break;
+      // Restarted by riftwm_restart
+      case 'H':
+        wm.handoff_fd = atoi(optarg);
+        break;
+      // Shape windows are arranged on
+      case 'L':
+        if (!strcmp(optarg, "sphere")) {
+          wm.layout_shape = LAYOUT_SPHERE;
+        } else if (!strcmp(optarg, "cylinder")) {
+          wm.layout_shape = LAYOUT_CYLINDER;
+        } else {
+          usage();
+          return EXIT_FAILURE;
+        }
+        break;
+      // Cap on window texture memory
+      case 'B':
+        wm.texture_budget = (size_t)atol(optarg) << 20;
+        break;
+      // Trade the small mip levels for anisotropic filtering
+      case 'A':
+        wm.anisotropy = atof(optarg);
+        break;
+      // Undistorted mirror for the audience
+      case 'S':
+      {
+        int x = 0, y = 0;
+        unsigned w = 0, h = 0;
+
+        if (!(XParseGeometry(optarg, &x, &y, &w, &h) &
+              (WidthValue | HeightValue)))
+        {
+          usage();
+          return EXIT_FAILURE;
+        }
+        wm.spectator_x = x;
+        wm.spectator_y = y;
+        wm.spectator_width = w;
+        wm.spectator_height = h;
+        break;
+      }
+      case 'R':
+        wm.spectator_rate = atof(optarg);
+        if (wm.spectator_rate <= 0.0f) {
+          usage();
+          return EXIT_FAILURE;
+        }
+        break;
+      // Smaller eye buffers, with text kept sharp by --layers
+      case 'E':
+        wm.eye_scale = atof(optarg);
+        if (wm.eye_scale <= 0.0f || wm.eye_scale > 1.0f) {
+          usage();
+          return EXIT_FAILURE;
+        }
+        break;
+      // Recording of the frames sent to the headset
+      case 'C':
+        wm.capture_path = optarg;
+        break;
+      // Event trace written in the background
+      case 'T':
+        wm.trace_path = optarg;
+        break;
+      // Convert a trace for chrome://tracing or Perfetto and quit
+      case 'J':
+        if (!trace_convert(optarg, stdout)) {
+          fprintf(stderr, "Cannot read trace %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
       // Help was requested or wrong commands given
       case 'h':
         usage();
@@ -856,6 +2154,8 @@ main(int argc, char **argv)
   // Run the wm
   riftwm_init(&wm);
   scan_windows(&wm);
+  handoff_free(wm.handoff);
+  wm.handoff = NULL;
   riftwm_run(&wm);
   riftwm_destroy(&wm);
   return EXIT_SUCCESS;
@@ -5,12 +5,49 @@
 #define __RIFTWM_RIFTWM_H__
 
 #include <setjmp.h>
+#include <stddef.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/composite.h>
+#include <X11/extensions/Xdamage.h>
 #include <openhmd/openhmd.h>
 #include <GL/glew.h>
 #include <GL/glx.h>
 #include "linmath.h"
+#include "layout.h"
+#include "ewmh.h"
+#include "atlas.h"
+#include "upload.h"
+#include "trace.h"
+
+// Longest the main loop sleeps waiting for X events, in milliseconds
+#define RIFTWM_TICK 8
+// Number of virtual workspaces
+#define RIFTWM_WORKSPACES 4
+// Longest side of the thumbnails kept for hidden windows, in pixels
+#define RIFTWM_THUMB_SIZE 256
+// Size of the workspace miniatures in the overview
+#define RIFTWM_OVERVIEW_SCALE 0.12f
+// GPU time the mip updater may spend per tick, in milliseconds
+#define RIFTWM_MIP_BUDGET 1.0
+// Initial guess of the blit rate, in source texels per millisecond
+#define RIFTWM_MIP_RATE (1 << 20)
+// Field of view within which windows count as viewed, wider than the
+// headset so textures are back before they are needed
+#define RIFTWM_VIEW_FOV 2.0f
+// Length of a simulation step, in seconds
+#define RIFTWM_SIM_STEP (1.0 / 60.0)
+// Steps run per loop at most, time beyond that is dropped
+#define RIFTWM_SIM_MAX_STEPS 5
+// Walking speed, in units per second
+#define RIFTWM_MOVE_SPEED 9.0f
+// Default refresh rate of the spectator mirror, in Hz
+#define RIFTWM_SPECTATOR_RATE 30.0f
+// Time spent refreshing damaged windows per tick, in seconds
+#define RIFTWM_REFRESH_BUDGET 0.004
+// Share of the refresh budget of focused and viewed windows, relative to
+// the others
+#define RIFTWM_FOCUS_WEIGHT 4
+#define RIFTWM_VIEW_WEIGHT 2
 
 // -----------------------------------------------------------------------------
 #ifdef __cplusplus
@@ -21,6 +58,7 @@ typedef void (*glXBindTexImageEXTProc) (Display*, GLXDrawable, int, const int*);
 typedef void (*glXReleaseTexImageEXTProc) (Display*, GLXDrawable, int);
 typedef struct renderer_t renderer_t;
 typedef struct kinect_t   kinect_t;
+typedef struct handoff_t  handoff_t;
 
 typedef struct riftwin_t
 {
@@ -28,21 +66,83 @@ typedef struct riftwin_t
   GLuint            texture;
   Pixmap            pixmap;
   GLXPixmap         glx_pixmap;
+  Damage            damage;
   int               glx_bound;
   int               width;
   int               height;
+  int               depth;
+  Visual           *visual;
   int               dirty;
+  int               damaged;
+  int               damage_box[4];
   int               mapped;
   int               focused;
-  char             *name;
+  int               workspace;
+  int               x;
+  int               y;
   vec3              pos;
   vec3              rot;
   float             r_width;
   float             r_height;
 
+  // Placement by the layout: cell, running animation and world transform
+  int               cell;
+  int               anim;
+  mat4x4            model;
+  aabb_t            bounds;
+
+  // Windows placed in front of a parent or docked instead of in a cell
+  layout_attach_t   attach;
+  struct riftwin_t *parent;
+
+  // Client properties, read again only after a PropertyNotify. Mapped
+  // windows wait for them to be placed.
+  char             *name;
+  char             *wm_class;
+  Window            transient_for;
+  ewmh_type_t       type;
+  unsigned          state;
+  unsigned          props_pending;
+  int               unplaced;
+
+  // Snapshot shown in the overview while the workspace is hidden
+  GLuint            thumb;
+  int               thumb_width;
+  int               thumb_height;
+
+  // Copy with a mip chain, rebuilt from the damaged rectangle one level at
+  // a time
+  GLuint            mips;
+  int               mip_levels;
+  int               mip_next;
+  int               mip_box[4];
+
+  // Texture memory held and whether it was given up for the budget
+  size_t            bytes;
+  int               mipmaps;
+  int               evicted;
+  int               viewed;
+  double            last_viewed;
+
+  // Position of the contents in the shared atlas, if small enough
+  int               atlas;
+  int               atlas_pos[2];
+
+  // Refresh scheduling: rate cap set by the client through _RIFTWM_MAX_FPS,
+  // 0 for none, and priority earned while waiting
+  float             max_fps;
+  double            last_refresh;
+  int               credit;
+
   struct riftwin_t *next;
 } riftwin_t;
 
+typedef struct riftws_t
+{
+  layout_t          layout;
+  mat4x4            overview;
+} riftws_t;
+
 typedef struct riftfb_t
 {
   GLXFBConfig       config;
@@ -56,10 +156,18 @@ typedef struct riftwm_t
   Window                     root;
   Window                     overlay;
   GLXContext                 context;
+  GLXContext                 render_context;
+  GLXContext                 spectator_context;
   riftfb_t                  *fb_config;
   int                        fb_count;
   glXBindTexImageEXTProc     glXBindTexImageEXT;
   glXReleaseTexImageEXTProc  glXReleaseTexImageEXT;
+  int                        streaming;
+  upload_t                   upload;
+
+  int                        damage_event;
+  int                        damage_error;
+  int                        x_errors;
 
   int                        screen_width;
   int                        screen_height;
@@ -77,16 +185,65 @@ typedef struct riftwm_t
   char                      *err_msg;
 
   int                        verbose;
+  const char                *trace_path;
+  int                        shader_reload;
+  const char                *capture_path;
+  int                        passthrough;
+  int                        layers;
+  float                      eye_scale;
+  int                        foveate;
+  int                        no_batch;
+  unsigned                   depth_serial;
+  trace_t                    trace;
+  char                     **argv;
+  int                        handoff_fd;
+  handoff_t                 *handoff;
+  double                     restarted_at;
   volatile int               running;
   riftwin_t                 *windows;
   int                        window_count;
+  layout_shape_t             layout_shape;
+  riftws_t                   workspaces[RIFTWM_WORKSPACES];
+  int                        workspace;
+  int                        overview;
+  GLuint                     copy_fbo[2];
+  GLuint                     mip_query;
+  long                       mip_texels;
+  double                     mip_rate;
+  atlas_t                    atlas;
+  int                        gl_pending;
+
+  float                      anisotropy;
+  size_t                     texture_bytes;
+  size_t                     texture_budget;
+  int                        evictions;
+  aabb_t                    *view_bounds;
+  int                       *view_visible;
+  int                        view_cap;
+  riftwin_t                **refresh;
+  int                        refresh_cap;
+  ewmh_t                     ewmh;
 
   int                        has_rift;
+  int                        mono;
+  Window                     spectator;
+  Colormap                   spectator_cmap;
+  int                        spectator_x;
+  int                        spectator_y;
+  int                        spectator_width;
+  int                        spectator_height;
+  float                      spectator_rate;
   ohmd_context              *rift_ctx;
   ohmd_device               *rift_dev;
   renderer_t                *renderer;
   kinect_t                  *kinect;
   float                      head_pos[3];
+
+  // Fixed-step clock: time not yet simulated and the camera position after
+  // the last two steps
+  double                     sim_time;
+  vec3                       sim_prev;
+  vec3                       sim_pos;
 } riftwm_t;
 
 // -----------------------------------------------------------------------------
@@ -96,7 +253,8 @@ void riftwm_scan(riftwm_t *);
 void riftwm_destroy(riftwm_t *);
 void riftwm_restart(riftwm_t *);
 void riftwm_error(riftwm_t *, const char *, ...);
-void riftwin_update(riftwm_t *, riftwin_t *);
+double riftwm_time(void);
+int riftwin_update(riftwm_t *, riftwin_t *);
 
 #ifdef __cplusplus
 }
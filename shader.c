@@ -0,0 +1,422 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "riftwm.h"
+#include "shader.h"
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+static uint64_t
+hash_bytes(uint64_t h, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char*)data;
+  size_t i;
+
+  // FNV-1a
+  for (i = 0; i < len; ++i) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+static uint64_t
+hash_string(uint64_t h, const char *str)
+{
+  return hash_bytes(h, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+static char *
+read_file(const char *path, int *len)
+{
+  FILE *fin;
+  char *buffer;
+  long size;
+
+  if (!(fin = fopen(path, "rb"))) {
+    return NULL;
+  }
+
+  fseek(fin, 0, SEEK_END);
+  size = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+
+  assert((buffer = (char*)malloc(size + 1)));
+  if (size < 0 || fread(buffer, 1, size, fin) != (size_t)size) {
+    free(buffer);
+    fclose(fin);
+    return NULL;
+  }
+  buffer[size] = '\0';
+  fclose(fin);
+
+  *len = size;
+  return buffer;
+}
+
+static const char *
+base_name(const char *path)
+{
+  const char *name = strrchr(path, '/');
+  return name ? name + 1 : path;
+}
+
+// -----------------------------------------------------------------------------
+// Program cache
+// -----------------------------------------------------------------------------
+static void
+cache_path(shaders_t *l, uint64_t key, char *path, size_t size)
+{
+  snprintf(path, size, "%s/%016llx.bin", l->cache_dir, (unsigned long long)key);
+}
+
+static uint64_t
+cache_key(const char *vs, int vs_len, const char *fs, int fs_len)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+
+  // Binaries are only valid for the driver that produced them
+  h = hash_string(h, (const char*)glGetString(GL_VENDOR));
+  h = hash_string(h, (const char*)glGetString(GL_RENDERER));
+  h = hash_string(h, (const char*)glGetString(GL_VERSION));
+  h = hash_bytes(h, vs, vs_len);
+  h = hash_bytes(h, &vs_len, sizeof(vs_len));
+  h = hash_bytes(h, fs, fs_len);
+  return h;
+}
+
+static GLuint
+cache_load(shaders_t *l, uint64_t key)
+{
+  char path[512], *data;
+  GLenum format;
+  GLint status;
+  GLuint prog;
+  int len;
+
+  cache_path(l, key, path, sizeof(path));
+  if (!(data = read_file(path, &len))) {
+    return 0;
+  }
+
+  if (len <= (int)sizeof(GLenum)) {
+    free(data);
+    return 0;
+  }
+
+  // A driver update may reject the binary, the sources are used then
+  memcpy(&format, data, sizeof(GLenum));
+  prog = glCreateProgram();
+  glProgramBinary(prog, format, data + sizeof(GLenum), len - sizeof(GLenum));
+  free(data);
+
+  glGetProgramiv(prog, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    glDeleteProgram(prog);
+    unlink(path);
+    return 0;
+  }
+
+  return prog;
+}
+
+static void
+cache_save(shaders_t *l, uint64_t key, GLuint prog)
+{
+  char path[512], *data;
+  GLenum format;
+  GLint len = 0;
+  FILE *fout;
+
+  glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &len);
+  if (len <= 0) {
+    return;
+  }
+
+  assert((data = (char*)malloc(len)));
+  glGetProgramBinary(prog, len, NULL, &format, data);
+
+  cache_path(l, key, path, sizeof(path));
+  if ((fout = fopen(path, "wb"))) {
+    fwrite(&format, sizeof(GLenum), 1, fout);
+    fwrite(data, 1, len, fout);
+    fclose(fout);
+  }
+  free(data);
+}
+
+// -----------------------------------------------------------------------------
+// Compilation
+// -----------------------------------------------------------------------------
+static GLuint
+compile(GLenum type, const char *src, int len, char *log, int log_size)
+{
+  GLint status;
+  GLuint sh;
+
+  sh = glCreateShader(type);
+  glShaderSource(sh, 1, &src, &len);
+  glCompileShader(sh);
+
+  glGetShaderiv(sh, GL_COMPILE_STATUS, &status);
+  if (status != GL_TRUE) {
+    glGetShaderInfoLog(sh, log_size, NULL, log);
+    glDeleteShader(sh);
+    return 0;
+  }
+
+  return sh;
+}
+
+static GLuint
+build(shaders_t *l, const char *vs, int vs_len, const char *fs, int fs_len,
+      char *log, int log_size)
+{
+  GLuint prog, vsh, fsh;
+  GLint status;
+  uint64_t key = 0;
+
+  if (l->cache_dir) {
+    key = cache_key(vs, vs_len, fs, fs_len);
+    if ((prog = cache_load(l, key))) {
+      return prog;
+    }
+  }
+
+  if (!(vsh = compile(GL_VERTEX_SHADER, vs, vs_len, log, log_size))) {
+    return 0;
+  }
+  if (!(fsh = compile(GL_FRAGMENT_SHADER, fs, fs_len, log, log_size))) {
+    glDeleteShader(vsh);
+    return 0;
+  }
+
+  prog = glCreateProgram();
+  if (l->cache_dir) {
+    glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glAttachShader(prog, vsh);
+  glAttachShader(prog, fsh);
+  glLinkProgram(prog);
+  glDetachShader(prog, vsh);
+  glDetachShader(prog, fsh);
+  glDeleteShader(vsh);
+  glDeleteShader(fsh);
+
+  glGetProgramiv(prog, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    glGetProgramInfoLog(prog, log_size, NULL, log);
+    glDeleteProgram(prog);
+    return 0;
+  }
+
+  if (l->cache_dir) {
+    cache_save(l, key, prog);
+  }
+  return prog;
+}
+
+static GLuint
+build_files(shaders_t *l, shader_t *s, char *log, int log_size)
+{
+  char *vs, *fs;
+  int vs_len, fs_len;
+  GLuint prog = 0;
+
+  vs = read_file(s->vs_path, &vs_len);
+  fs = read_file(s->fs_path, &fs_len);
+  if (!vs || !fs) {
+    snprintf(log, log_size, "Cannot read %s", vs ? s->fs_path : s->vs_path);
+  } else {
+    prog = build(l, vs, vs_len, fs, fs_len, log, log_size);
+  }
+
+  free(vs);
+  free(fs);
+  return prog;
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+void
+shaders_init(shaders_t *l, riftwm_t *wm, int reload)
+{
+  const char *base;
+  char path[512];
+  size_t n;
+
+  memset(l, 0, sizeof(shaders_t));
+  l->wm = wm;
+  l->inotify = -1;
+
+  // Binaries go to $XDG_CACHE_HOME/riftwm or ~/.cache/riftwm
+  if (GLEW_ARB_get_program_binary) {
+    if ((base = getenv("XDG_CACHE_HOME")) && *base) {
+      snprintf(path, sizeof(path), "%s", base);
+    } else if ((base = getenv("HOME")) && *base) {
+      snprintf(path, sizeof(path), "%s/.cache", base);
+    } else {
+      path[0] = '\0';
+    }
+
+    if (path[0]) {
+      mkdir(path, 0700);
+      n = strlen(path);
+      snprintf(path + n, sizeof(path) - n, "/%s", SHADER_CACHE);
+      if (!mkdir(path, 0700) || errno == EEXIST) {
+        assert((l->cache_dir = strdup(path)));
+      }
+    }
+  }
+
+  // Editors replace files as often as they rewrite them
+  if (reload) {
+    if ((l->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+        inotify_add_watch(l->inotify, SHADER_DIR,
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+      riftwm_error(wm, "Cannot watch %s", SHADER_DIR);
+    }
+  }
+}
+
+static GLuint
+load(shaders_t *l, shader_t *s, const char *vs_path, const unsigned char *vs,
+     unsigned vs_len, const char *fs_path, const unsigned char *fs,
+     unsigned fs_len, char *log, int log_size)
+{
+  s->vs_path = vs_path;
+  s->fs_path = fs_path;
+  s->vs = (const char*)vs;
+  s->vs_len = vs_len;
+  s->fs = (const char*)fs;
+  s->fs_len = fs_len;
+
+  // In reload mode the files are the reference from the start
+  log[0] = '\0';
+  s->prog = l->inotify >= 0
+          ? build_files(l, s, log, log_size)
+          : build(l, s->vs, s->vs_len, s->fs, s->fs_len, log, log_size);
+
+  if (s->prog && l->count < SHADER_MAX) {
+    l->shaders[l->count++] = s;
+  }
+  return s->prog;
+}
+
+void
+shader_init(shaders_t *l, shader_t *s, const char *vs_path,
+            const unsigned char *vs, unsigned vs_len, const char *fs_path,
+            const unsigned char *fs, unsigned fs_len)
+{
+  char log[1024];
+
+  if (!load(l, s, vs_path, vs, vs_len, fs_path, fs, fs_len, log,
+            sizeof(log)))
+  {
+    riftwm_error(l->wm, "Shader %s: %s", vs_path, log);
+  }
+}
+
+int
+shader_init_optional(shaders_t *l, shader_t *s, const char *vs_path,
+                     const unsigned char *vs, unsigned vs_len,
+                     const char *fs_path, const unsigned char *fs,
+                     unsigned fs_len)
+{
+  char log[1024];
+
+  if (!load(l, s, vs_path, vs, vs_len, fs_path, fs, fs_len, log,
+            sizeof(log)))
+  {
+    fprintf(stderr, "Shader %s: %s\n", vs_path, log);
+    return 0;
+  }
+  return 1;
+}
+
+int
+shaders_poll(shaders_t *l)
+{
+  char buffer[4096], log[1024];
+  struct inotify_event *evt;
+  unsigned dirty = 0;
+  shader_t *s;
+  GLuint prog;
+  ssize_t len;
+  char *p;
+  int i, count = 0;
+
+  if (l->inotify < 0) {
+    return 0;
+  }
+
+  while ((len = read(l->inotify, buffer, sizeof(buffer))) > 0) {
+    for (p = buffer; p < buffer + len; p += sizeof(*evt) + evt->len) {
+      evt = (struct inotify_event*)p;
+      if (!evt->len) {
+        continue;
+      }
+      for (i = 0; i < l->count; ++i) {
+        s = l->shaders[i];
+        if (!strcmp(evt->name, base_name(s->vs_path)) ||
+            !strcmp(evt->name, base_name(s->fs_path)))
+        {
+          dirty |= 1u << i;
+        }
+      }
+    }
+  }
+
+  // A broken edit keeps the previous program running
+  for (i = 0; i < l->count; ++i) {
+    if (!(dirty & (1u << i))) {
+      continue;
+    }
+
+    s = l->shaders[i];
+    log[0] = '\0';
+    if (!(prog = build_files(l, s, log, sizeof(log)))) {
+      fprintf(stderr, "Shader %s: %s\n", s->vs_path, log);
+      continue;
+    }
+
+    glDeleteProgram(s->prog);
+    s->prog = prog;
+    fprintf(stderr, "Reloaded %s\n", s->vs_path);
+    ++count;
+  }
+
+  return count;
+}
+
+void
+shaders_destroy(shaders_t *l)
+{
+  int i;
+
+  for (i = 0; i < l->count; ++i) {
+    if (l->shaders[i]->prog) {
+      glDeleteProgram(l->shaders[i]->prog);
+      l->shaders[i]->prog = 0;
+    }
+  }
+
+  if (l->inotify >= 0) {
+    close(l->inotify);
+  }
+  free(l->cache_dir);
+  memset(l, 0, sizeof(shaders_t));
+  l->inotify = -1;
+}
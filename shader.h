@@ -0,0 +1,61 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include <GL/glew.h>
+
+// Directory watched for edited sources in reload mode
+#define SHADER_DIR "shader"
+// Subdirectory of the user cache directory holding program binaries
+#define SHADER_CACHE "riftwm"
+// Programs a library can reload
+#define SHADER_MAX 8
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Program built from a vertex and a fragment shader. The sources are
+// embedded at build time; the paths are only read in reload mode.
+typedef struct shader_t
+{
+  GLuint            prog;
+  const char       *vs_path;
+  const char       *fs_path;
+  const char       *vs;
+  int               vs_len;
+  const char       *fs;
+  int               fs_len;
+} shader_t;
+
+// Builds programs, caching the linked binaries on disk so that restarts
+// skip compilation, and rebuilds them when their files change
+typedef struct shaders_t
+{
+  struct riftwm_t  *wm;
+  char             *cache_dir;
+  int               inotify;
+  shader_t         *shaders[SHADER_MAX];
+  int               count;
+} shaders_t;
+
+void shaders_init(shaders_t *, struct riftwm_t *, int reload);
+void shader_init(shaders_t *, shader_t *, const char *vs_path,
+                 const unsigned char *vs, unsigned vs_len,
+                 const char *fs_path, const unsigned char *fs,
+                 unsigned fs_len);
+int shader_init_optional(shaders_t *, shader_t *, const char *vs_path,
+                         const unsigned char *vs, unsigned vs_len,
+                         const char *fs_path, const unsigned char *fs,
+                         unsigned fs_len);
+int shaders_poll(shaders_t *);
+void shaders_destroy(shaders_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__SHADER_H__*/
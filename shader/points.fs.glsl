@@ -0,0 +1,9 @@
+#version 120
+// Closer points are brighter
+varying float v_depth;
+
+void main()
+{
+  float c = clamp(1.5 - v_depth / 3000.0, 0.2, 1.0);
+  gl_FragColor = vec4(c, c, c, 1.0);
+}
@@ -0,0 +1,32 @@
+#version 120
+// Kinect depth unprojected into the world, one point per depth pixel.
+// Positions follow the mapping used for the head: millimetres from the
+// calibrated origin, 200 to a unit.
+attribute vec2 a_pixel;
+attribute float a_depth;
+
+uniform vec2 u_fov_scale;
+uniform vec3 u_shift;
+uniform vec3 u_origin;
+
+varying float v_depth;
+
+void main()
+{
+  vec3 p;
+
+  // No reading: outside the clip volume
+  if (a_depth <= 0.0) {
+    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    v_depth = 0.0;
+    return;
+  }
+
+  p.x = (a_pixel.x - 0.5) * a_depth * u_fov_scale.x;
+  p.y = (0.5 - a_pixel.y) * a_depth * u_fov_scale.y;
+  p.z = a_depth;
+
+  gl_Position = gl_ModelViewProjectionMatrix *
+                vec4((u_shift - p) / 200.0 - u_origin, 1.0);
+  v_depth = a_depth;
+}
@@ -1,47 +1,84 @@
 #version 120
-// https://github.com/OpenHMD/OpenHMD/blob/master/examples/opengl/shaders/test1.vert.glsl
+// Distortion and chromatic aberration are baked into the warp mesh, see
+// distort.c. Samples outside the eye buffer hit its black border.
 uniform sampler2D u_texture;
-uniform int u_scr_w = 640;
-uniform int u_scr_h = 800;
-
-const vec2 LeftLensCenter = vec2(0.2863248, 0.5);
-const vec2 RightLensCenter = vec2(0.7136753, 0.5);
-const vec2 LeftScreenCenter = vec2(0.25, 0.5);
-const vec2 RightScreenCenter = vec2(0.75, 0.5);
-const vec2 Scale = vec2(0.1469278, 0.2350845);
-const vec2 ScaleIn = vec2(4, 2.5);
-const vec4 HmdWarpParam   = vec4(1, 0.22, 0.24, 0);
-
-// Scales input texture coordinates for distortion.
-vec2 HmdWarp(vec2 in01, vec2 LensCenter)
+
+// Windows drawn as layers: each matrix takes eye buffer clip space to the
+// window's quad, whose texture is then sampled once instead of twice.
+// Layers come sorted back to front and are hidden wherever the depth of
+// the eye buffer holds something nearer.
+uniform int u_layer_count;
+uniform mat4 u_layer[4];
+uniform sampler2D u_layer_tex[4];
+uniform sampler2D u_depth;
+
+// Foveated eyes: u_texture holds the whole eye at a lower resolution and
+// u_inset the square of side u_fovea around the lens centre at full
+// density. u_fovea is 0 when the eye buffer is uniform.
+uniform float u_fovea;
+uniform vec2 u_fovea_center;
+uniform sampler2D u_inset;
+
+varying vec2 v_tc_r;
+varying vec2 v_tc_g;
+varying vec2 v_tc_b;
+
+vec4 layer(sampler2D tex, mat4 m, vec2 tc, vec4 c)
 {
-  vec2 theta = (in01 - LensCenter) * ScaleIn; // Scales to [-1, 1]
-  float rSq = theta.x * theta.x + theta.y * theta.y;
-  vec2 rvector = theta * (HmdWarpParam.x + HmdWarpParam.y * rSq +
-    HmdWarpParam.z * rSq * rSq +
-    HmdWarpParam.w * rSq * rSq * rSq);
-  return LensCenter + Scale * rvector;
+  vec2 ndc = tc * 2.0 - 1.0;
+  vec4 a = m * vec4(ndc, -1.0, 1.0);
+  vec4 b = m * vec4(ndc, 1.0, 1.0);
+  vec4 h;
+  vec2 p;
+  float t;
+
+  // Where the ray through the pixel crosses the plane of the quad. The
+  // matrix is linear before the divide, so t is also the window depth.
+  t = a.z / (a.z - b.z);
+  h = mix(a, b, t);
+  p = h.xy / h.w;
+  if (t < 0.0 || t > 1.0 || abs(p.x) > 1.0 || abs(p.y) > 1.0 ||
+      texture2D(u_depth, tc).r < t)
+  {
+    return c;
+  }
+  return texture2D(tex, vec2(p.x + 1.0, 1.0 - p.y) * 0.5);
 }
 
-void main()
+vec4 eye(vec2 tc)
 {
-  if (abs(gl_FragCoord.x - u_scr_w) < 2) {
-    gl_FragColor = vec4(0.0, 1.0, 0.0, 1.0);
-    return;
+  vec4 c = texture2D(u_texture, tc);
+  vec2 d;
+  float m;
+
+  if (u_fovea <= 0.0) {
+    return c;
   }
 
-  vec2 LensCenter = gl_FragCoord.x < u_scr_w ? LeftLensCenter : RightLensCenter;
-  vec2 ScreenCenter = gl_FragCoord.x < u_scr_w ? LeftScreenCenter : RightScreenCenter;
+  // Fade into the periphery over the outer tenth of the inset
+  d = (tc - u_fovea_center) / u_fovea;
+  m = max(abs(d.x), abs(d.y)) * 2.0;
+  if (m >= 1.0) {
+    return c;
+  }
+  return mix(texture2D(u_inset, d + 0.5), c, smoothstep(0.9, 1.0, m));
+}
 
-  vec2 oTexCoord = gl_FragCoord.xy / vec2(u_scr_w * 2, u_scr_h);
+vec4 sample(vec2 tc)
+{
+  vec4 c = eye(tc);
 
-  vec2 tc = HmdWarp(oTexCoord, LensCenter);
-  if (any(bvec2(clamp(tc,ScreenCenter-vec2(0.25,0.5), ScreenCenter+vec2(0.25,0.5)) - tc)))
-  {
-    gl_FragColor = vec4(0.0, 0.0, 0.0, 1.0);
-    return;
-  }
+  if (u_layer_count > 0) c = layer(u_layer_tex[0], u_layer[0], tc, c);
+  if (u_layer_count > 1) c = layer(u_layer_tex[1], u_layer[1], tc, c);
+  if (u_layer_count > 2) c = layer(u_layer_tex[2], u_layer[2], tc, c);
+  if (u_layer_count > 3) c = layer(u_layer_tex[3], u_layer[3], tc, c);
+  return c;
+}
 
-  tc.x = gl_FragCoord.x < 640 ? (2.0 * tc.x) : (2.0 * (tc.x - 0.5));
-  gl_FragColor = texture2D(u_texture, tc);
-}
\ No newline at end of file
+void main()
+{
+  gl_FragColor = vec4(sample(v_tc_r).r,
+                      sample(v_tc_g).g,
+                      sample(v_tc_b).b,
+                      1.0);
+}
@@ -1,6 +1,27 @@
 #version 120
+// Rotation from the display pose back to the eye buffer's pose, in eye
+// buffer clip space. Identity unless the head moved since the eye was drawn.
+uniform mat4 u_timewarp;
+
+attribute vec2 a_pos;
+attribute vec2 a_tc_r;
+attribute vec2 a_tc_g;
+attribute vec2 a_tc_b;
+
+varying vec2 v_tc_r;
+varying vec2 v_tc_g;
+varying vec2 v_tc_b;
+
+vec2 timewarp(vec2 tc)
+{
+  vec4 p = u_timewarp * vec4(tc * 2.0 - 1.0, 0.5, 1.0);
+  return p.xy / p.w * 0.5 + 0.5;
+}
+
 void main()
 {
-  gl_TexCoord[0] = gl_MultiTexCoord0;
-  gl_Position = gl_Vertex;
+  v_tc_r = timewarp(a_tc_r);
+  v_tc_g = timewarp(a_tc_g);
+  v_tc_b = timewarp(a_tc_b);
+  gl_Position = vec4(a_pos, 0.0, 1.0);
 }
\ No newline at end of file
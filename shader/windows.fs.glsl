@@ -0,0 +1,14 @@
+#version 400 compatibility
+// The unit differs between the sub-draws sharing an invocation, which
+// GLSL only allows with NV_gpu_shader5
+#extension GL_NV_gpu_shader5 : require
+// Size must match BATCH_UNITS
+uniform sampler2D u_textures[16];
+
+in vec2 v_tc;
+flat in int v_unit;
+
+void main()
+{
+  gl_FragColor = texture(u_textures[v_unit], v_tc);
+}
@@ -0,0 +1,17 @@
+#version 400 compatibility
+#extension GL_ARB_shader_draw_parameters : require
+// One window per sub-draw of a multi-draw: the model matrix comes from
+// the instance buffer and the draw index picks the texture unit
+in vec2 a_pos;
+in vec2 a_tc;
+in mat4 a_model;
+
+out vec2 v_tc;
+flat out int v_unit;
+
+void main()
+{
+  v_tc = a_tc;
+  v_unit = gl_DrawIDARB;
+  gl_Position = gl_ModelViewProjectionMatrix * a_model * vec4(a_pos, 0.0, 1.0);
+}
@@ -0,0 +1,213 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <stdlib.h>
+#include <string.h>
+#include <X11/X.h>
+#include "trace.h"
+
+static const char *STAGES[TRACE_STAGES] =
+{
+  "events", "simulate", "residency", "update",
+  "acquire", "scene", "warp", "swap", "spectator",
+  "capture"
+};
+
+static const char *XEVENTS[LASTEvent] =
+{
+  NULL, NULL, "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease",
+  "MotionNotify", "EnterNotify", "LeaveNotify", "FocusIn", "FocusOut",
+  "KeymapNotify", "Expose", "GraphicsExpose", "NoExpose",
+  "VisibilityNotify", "CreateNotify", "DestroyNotify", "UnmapNotify",
+  "MapNotify", "MapRequest", "ReparentNotify", "ConfigureNotify",
+  "ConfigureRequest", "GravityNotify", "ResizeRequest", "CirculateNotify",
+  "CirculateRequest", "PropertyNotify", "SelectionClear",
+  "SelectionRequest", "SelectionNotify", "ColormapNotify", "ClientMessage",
+  "MappingNotify", "GenericEvent"
+};
+
+// -----------------------------------------------------------------------------
+// Writer
+// -----------------------------------------------------------------------------
+static void
+drain(trace_t *t)
+{
+  trace_ring_t *r;
+  unsigned head, tail, n;
+  int i;
+
+  for (i = 0; i < TRACE_THREADS; ++i) {
+    r = &t->rings[i];
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    tail = r->tail;
+
+    // At most two contiguous runs, split where the ring wraps around
+    while (tail != head) {
+      n = TRACE_RING_SIZE - (tail & (TRACE_RING_SIZE - 1));
+      n = n < head - tail ? n : head - tail;
+      fwrite(&r->events[tail & (TRACE_RING_SIZE - 1)], sizeof(trace_event_t),
+             n, t->file);
+      tail += n;
+    }
+
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+  }
+}
+
+static void *
+trace_thread(void *arg)
+{
+  trace_t *t = (trace_t*)arg;
+  struct timespec ts = { 0, TRACE_FLUSH_MS * 1000000 };
+
+  while (t->running) {
+    drain(t);
+    fflush(t->file);
+    nanosleep(&ts, NULL);
+  }
+
+  drain(t);
+  return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+int
+trace_open(trace_t *t, const char *path)
+{
+  trace_header_t h;
+
+  memset(t, 0, sizeof(trace_t));
+  if (!(t->file = fopen(path, "wb"))) {
+    return 0;
+  }
+
+  memcpy(h.magic, "RWTR", 4);
+  h.version = TRACE_VERSION;
+  fwrite(&h, sizeof(h), 1, t->file);
+
+  t->running = 1;
+  if (pthread_create(&t->thread, NULL, trace_thread, t)) {
+    fclose(t->file);
+    t->file = NULL;
+    t->running = 0;
+    return 0;
+  }
+
+  t->enabled = 1;
+  return 1;
+}
+
+void
+trace_close(trace_t *t)
+{
+  unsigned dropped = 0;
+  int i;
+
+  if (!t->file) {
+    return;
+  }
+
+  t->enabled = 0;
+  t->running = 0;
+  pthread_join(t->thread, NULL);
+  fclose(t->file);
+  t->file = NULL;
+
+  for (i = 0; i < TRACE_THREADS; ++i) {
+    dropped += t->rings[i].dropped;
+  }
+  if (dropped) {
+    fprintf(stderr, "Trace: %u events dropped\n", dropped);
+  }
+}
+
+int
+trace_convert(const char *path, FILE *out)
+{
+  trace_header_t h;
+  trace_event_t e;
+  uint64_t base = 0;
+  double ts;
+  FILE *in;
+  int first = 1;
+
+  if (!(in = fopen(path, "rb"))) {
+    return 0;
+  }
+
+  if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, "RWTR", 4) ||
+      h.version != TRACE_VERSION)
+  {
+    fclose(in);
+    return 0;
+  }
+
+  // Chrome trace event format, also read by Perfetto
+  fputs("{\"traceEvents\":[\n", out);
+  while (fread(&e, sizeof(e), 1, in) == 1) {
+    if (first) {
+      base = e.time;
+    }
+    ts = (e.time - base) / 1000.0;
+
+    fputs(first ? "" : ",\n", out);
+    first = 0;
+    switch (e.type) {
+      case TRACE_BEGIN:
+      case TRACE_END:
+      {
+        fprintf(out, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                "\"pid\":1,\"tid\":%u}",
+                e.arg < TRACE_STAGES ? STAGES[e.arg] : "stage",
+                e.type == TRACE_BEGIN ? 'B' : 'E', ts, e.thread);
+        break;
+      }
+      case TRACE_XEVENT:
+      {
+        if (e.arg < LASTEvent && XEVENTS[e.arg]) {
+          fprintf(out, "{\"name\":\"%s\"", XEVENTS[e.arg]);
+        } else {
+          fprintf(out, "{\"name\":\"Event %u\"", e.arg);
+        }
+        fprintf(out, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                "\"pid\":1,\"tid\":%u}", ts, e.thread);
+        break;
+      }
+      case TRACE_HEAD:
+      {
+        fprintf(out, "{\"name\":\"head\",\"ph\":\"C\",\"ts\":%.3f,"
+                "\"pid\":1,\"tid\":%u,\"args\":{\"x\":%f,\"y\":%f,\"z\":%f}}",
+                ts, e.thread, e.value[0], e.value[1], e.value[2]);
+        break;
+      }
+      case TRACE_TEXTURES:
+      {
+        fprintf(out, "{\"name\":\"textures\",\"ph\":\"C\",\"ts\":%.3f,"
+                "\"pid\":1,\"tid\":%u,\"args\":{\"used\":%f,"
+                "\"budget\":%f,\"evictions\":%.0f}}",
+                ts, e.thread, e.value[0], e.value[1], e.value[2]);
+        break;
+      }
+      case TRACE_PLACE:
+      {
+        fprintf(out, "{\"name\":\"place\",\"ph\":\"i\",\"s\":\"t\","
+                "\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{"
+                "\"window\":%u,\"type\":%.0f}}", ts, e.thread, e.arg,
+                e.value[0]);
+        break;
+      }
+      default:
+      {
+        fprintf(out, "{\"name\":\"unknown\",\"ph\":\"i\",\"ts\":%.3f,"
+                "\"pid\":1,\"tid\":%u}", ts, e.thread);
+        break;
+      }
+    }
+  }
+  fputs("\n]}\n", out);
+
+  fclose(in);
+  return 1;
+}
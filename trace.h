@@ -0,0 +1,149 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+// Events each ring holds, a power of two
+#define TRACE_RING_SIZE 16384
+// Interval at which the writer drains the rings, in milliseconds
+#define TRACE_FLUSH_MS 10
+// Version of the file format
+#define TRACE_VERSION 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Threads that record events, one ring each
+typedef enum
+{
+  TRACE_MAIN,
+  TRACE_RENDER,
+  TRACE_THREADS
+} trace_thread_t;
+
+typedef enum
+{
+  TRACE_BEGIN,
+  TRACE_END,
+  TRACE_XEVENT,
+  TRACE_HEAD,
+  TRACE_TEXTURES,
+  TRACE_PLACE
+} trace_type_t;
+
+// Stages timed with TRACE_BEGIN and TRACE_END
+typedef enum
+{
+  TRACE_EVENTS,
+  TRACE_SIMULATE,
+  TRACE_RESIDENCY,
+  TRACE_UPDATE,
+  TRACE_ACQUIRE,
+  TRACE_SCENE,
+  TRACE_WARP,
+  TRACE_SWAP,
+  TRACE_SPECTATOR,
+  TRACE_CAPTURE,
+  TRACE_STAGES
+} trace_stage_t;
+
+// Record as stored in the file: 32 bytes, time in nanoseconds
+typedef struct trace_event_t
+{
+  uint64_t          time;
+  uint16_t          type;
+  uint16_t          thread;
+  uint32_t          arg;
+  float             value[4];
+} trace_event_t;
+
+typedef struct trace_header_t
+{
+  char              magic[4];
+  uint32_t          version;
+} trace_header_t;
+
+// Single producer ring: the owning thread advances head, the writer tail
+typedef struct trace_ring_t
+{
+  trace_event_t     events[TRACE_RING_SIZE];
+  unsigned          head __attribute__((aligned(64)));
+  unsigned          tail __attribute__((aligned(64)));
+  unsigned          dropped;
+} trace_ring_t;
+
+// Binary event trace, drained to a file by a background thread. Recording
+// takes a clock read and a few stores, with no locks or system calls;
+// events are dropped rather than waited for when a ring is full.
+typedef struct trace_t
+{
+  volatile int      enabled;
+  volatile int      running;
+  FILE             *file;
+  pthread_t         thread;
+  trace_ring_t      rings[TRACE_THREADS];
+} trace_t;
+
+int trace_open(trace_t *, const char *path);
+void trace_close(trace_t *);
+int trace_convert(const char *path, FILE *out);
+
+static inline void
+trace_emit(trace_t *t, trace_thread_t thread, trace_type_t type,
+           uint32_t arg, const float *value)
+{
+  trace_ring_t *r;
+  trace_event_t *e;
+  struct timespec ts;
+  unsigned head;
+
+  if (!t->enabled) {
+    return;
+  }
+
+  r = &t->rings[thread];
+  head = r->head;
+  if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE) {
+    r->dropped++;
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  e = &r->events[head & (TRACE_RING_SIZE - 1)];
+  e->time = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  e->type = type;
+  e->thread = thread;
+  e->arg = arg;
+  if (value) {
+    e->value[0] = value[0];
+    e->value[1] = value[1];
+    e->value[2] = value[2];
+  }
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+trace_begin(trace_t *t, trace_thread_t thread, trace_stage_t stage)
+{
+  trace_emit(t, thread, TRACE_BEGIN, stage, NULL);
+}
+
+static inline void
+trace_end(trace_t *t, trace_thread_t thread, trace_stage_t stage)
+{
+  trace_emit(t, thread, TRACE_END, stage, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__TRACE_H__*/
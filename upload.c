@@ -0,0 +1,229 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xutil.h>
+#include "upload.h"
+
+// -----------------------------------------------------------------------------
+// Staging buffers
+// -----------------------------------------------------------------------------
+static void
+slot_init(upload_t *u, upload_slot_t *s)
+{
+  const GLbitfield FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                           GL_MAP_COHERENT_BIT;
+
+  glGenBuffers(1, &s->pbo);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+  if (u->persistent) {
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, UPLOAD_SLOT_SIZE, NULL, FLAGS);
+    s->mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, UPLOAD_SLOT_SIZE,
+                                 FLAGS);
+  } else {
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, UPLOAD_SLOT_SIZE, NULL,
+                 GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static int
+slot_ready(upload_t *u, upload_slot_t *s)
+{
+  GLenum status;
+
+  // A persistent buffer can only be reused once the GPU is done with it.
+  // The fence is polled: waiting would stall the main thread on the GPU.
+  if (u->persistent && s->fence) {
+    status = glClientWaitSync(s->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      return 0;
+    }
+    glDeleteSync(s->fence);
+    s->fence = 0;
+  }
+  return 1;
+}
+
+static void *
+slot_begin(upload_t *u, upload_slot_t *s)
+{
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+  if (u->persistent) {
+    return s->mapped;
+  }
+
+  // Otherwise orphan the old storage and let the driver find new memory
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, UPLOAD_SLOT_SIZE, NULL, GL_STREAM_DRAW);
+  return glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, UPLOAD_SLOT_SIZE,
+                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+static void
+slot_end(upload_t *u, upload_slot_t *s)
+{
+  if (u->persistent) {
+    s->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// -----------------------------------------------------------------------------
+// Exported API
+// -----------------------------------------------------------------------------
+int
+upload_init(upload_t *u, Display *dpy)
+{
+  int i;
+
+  memset(u, 0, sizeof(upload_t));
+  u->dpy = dpy;
+  u->shm.shmid = -1;
+
+  if (!XShmQueryExtension(dpy)) {
+    return 0;
+  }
+
+  // One segment, big enough for a strip of any damaged rectangle
+  if ((u->shm.shmid = shmget(IPC_PRIVATE, UPLOAD_SLOT_SIZE,
+                             IPC_CREAT | 0600)) < 0)
+  {
+    return 0;
+  }
+
+  u->shm.shmaddr = (char*)shmat(u->shm.shmid, NULL, 0);
+  u->shm.readOnly = False;
+  if (u->shm.shmaddr == (char*)-1 || !XShmAttach(dpy, &u->shm)) {
+    upload_destroy(u);
+    return 0;
+  }
+  u->attached = 1;
+
+  // Removed now, freed by the kernel once both sides detach
+  XSync(dpy, False);
+  shmctl(u->shm.shmid, IPC_RMID, NULL);
+
+  u->persistent = GLEW_ARB_buffer_storage;
+  for (i = 0; i < UPLOAD_RING; ++i) {
+    slot_init(u, &u->slots[i]);
+  }
+
+  return 1;
+}
+
+int
+upload_rect(upload_t *u, Drawable src, Visual *visual, int depth,
+            GLuint texture, int x, int y, int width, int height)
+{
+  upload_slot_t *s;
+  XImage *image;
+  GLenum format, type;
+  void *dst;
+  int rows, done = 0;
+  size_t size;
+
+  if (width <= 0 || height <= 0) {
+    return 0;
+  }
+
+  // Wide rectangles are split into strips of rows that fit a slot, sized
+  // for the widest pixels
+  rows = UPLOAD_SLOT_SIZE / (width * 4);
+  if (rows <= 0) {
+    return -1;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  for (; height > 0; y += rows, height -= rows) {
+    rows = rows < height ? rows : height;
+
+    // Strips that find no free slot are left to the next tick
+    s = &u->slots[u->next];
+    if (!slot_ready(u, s)) {
+      break;
+    }
+
+    if (!(image = XShmCreateImage(u->dpy, visual, depth, ZPixmap,
+                                  u->shm.shmaddr, &u->shm, width, rows)))
+    {
+      done = done ? done : -1;
+      break;
+    }
+
+    // Opaque and translucent windows come as 32 bits, 16 bit visuals
+    // pack each pixel in a short
+    if (image->bits_per_pixel == 32) {
+      format = GL_BGRA;
+      type = GL_UNSIGNED_BYTE;
+    } else if (image->bits_per_pixel == 16) {
+      format = GL_RGB;
+      type = GL_UNSIGNED_SHORT_5_6_5;
+    } else {
+      XFree(image);
+      done = done ? done : -1;
+      break;
+    }
+
+    // Zero-copy on the X side: the server writes straight into the segment
+    if (!XShmGetImage(u->dpy, src, image, x, y, AllPlanes)) {
+      XFree(image);
+      done = done ? done : -1;
+      break;
+    }
+
+    u->next = (u->next + 1) % UPLOAD_RING;
+    size = (size_t)image->bytes_per_line * rows;
+    if ((dst = slot_begin(u, s))) {
+      memcpy(dst, image->data, size);
+      if (!u->persistent) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      }
+      glPixelStorei(GL_UNPACK_ROW_LENGTH,
+                    image->bytes_per_line * 8 / image->bits_per_pixel);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, rows, format, type, 0);
+      u->bytes += size;
+    }
+    slot_end(u, s);
+    XFree(image);
+    done += rows;
+  }
+
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return done;
+}
+
+void
+upload_destroy(upload_t *u)
+{
+  upload_slot_t *s;
+  int i;
+
+  for (i = 0; i < UPLOAD_RING; ++i) {
+    s = &u->slots[i];
+    if (s->fence) {
+      glDeleteSync(s->fence);
+    }
+    if (s->pbo) {
+      glDeleteBuffers(1, &s->pbo);
+    }
+  }
+
+  if (u->attached) {
+    XShmDetach(u->dpy, &u->shm);
+  }
+  if (u->shm.shmaddr && u->shm.shmaddr != (char*)-1) {
+    shmdt(u->shm.shmaddr);
+  }
+  if (u->shm.shmid >= 0) {
+    shmctl(u->shm.shmid, IPC_RMID, NULL);
+  }
+
+  memset(u, 0, sizeof(upload_t));
+  u->shm.shmid = -1;
+}
@@ -0,0 +1,55 @@
+// This file is part of the RiftWM project
+// Licensing information can be found in the LICENSE file
+// (C) 2013 The RiftWM Project. All rights reserved.
+#ifndef __UPLOAD_H__
+#define __UPLOAD_H__
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+#include <GL/glew.h>
+
+// Size of the shared memory segment and of each staging buffer
+#define UPLOAD_SLOT_SIZE (4 << 20)
+// Number of staging buffers cycled through
+#define UPLOAD_RING 4
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Staging buffer, written by the CPU while the GPU reads the others
+typedef struct upload_slot_t
+{
+  GLuint            pbo;
+  GLsync            fence;
+  void             *mapped;
+} upload_slot_t;
+
+// Fallback for GL stacks without texture_from_pixmap: damaged rectangles
+// are read into shared memory with MIT-SHM and streamed into ordinary
+// textures through a ring of pixel buffers. The buffers stay mapped where
+// ARB_buffer_storage is available and are orphaned on each use otherwise.
+typedef struct upload_t
+{
+  Display          *dpy;
+  XShmSegmentInfo   shm;
+  int               attached;
+  int               persistent;
+  upload_slot_t     slots[UPLOAD_RING];
+  int               next;
+  size_t            bytes;
+} upload_t;
+
+int upload_init(upload_t *, Display *);
+// Returns the number of rows uploaded from the top of the rectangle, less
+// than height when the ring is busy, or -1 if nothing could be read
+int upload_rect(upload_t *, Drawable, Visual *, int depth, GLuint texture,
+                int x, int y, int width, int height);
+void upload_destroy(upload_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__UPLOAD_H__*/